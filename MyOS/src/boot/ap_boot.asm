@@ -0,0 +1,109 @@
+; MyOS Application Processor Startup
+; Real mode entry of the APs. smp_init() copies everything between
+; ap_trampoline_start and ap_trampoline_end to AP_TRAMPOLINE_PHYS, fills in
+; the parameters and sends the startup IPI with that page as the vector.
+
+AP_TRAMPOLINE_PHYS  equ 0x8000      ; Keep in sync with smp.h
+
+CR0_PE              equ 0x00000001
+CR0_WP              equ 0x00010000
+CR0_PG              equ 0x80000000
+CR4_PSE             equ 0x00000010
+CR4_PGE             equ 0x00000080
+
+CODE_SEG            equ 0x08
+DATA_SEG            equ 0x10
+
+; Address of a trampoline label once copied to low memory
+%define TRAMPOLINE(label) (AP_TRAMPOLINE_PHYS + (label) - ap_trampoline_start)
+
+extern gdt_descriptor
+extern ap_main
+
+section .text
+
+global ap_trampoline_start
+global ap_trampoline_end
+global ap_trampoline_cr3
+global ap_trampoline_stack
+global ap_trampoline_cpu
+
+bits 16
+ap_trampoline_start:
+    ; Started at CS:IP = AP_TRAMPOLINE_PHYS >> 4 : 0
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+
+    ; Flat segments from the temporary GDT below, still without paging
+    lgdt [TRAMPOLINE(ap_gdt_descriptor)]
+    mov eax, cr0
+    or eax, CR0_PE
+    mov cr0, eax
+    jmp dword CODE_SEG:TRAMPOLINE(ap_protected_mode)
+
+bits 32
+ap_protected_mode:
+    mov ax, DATA_SEG
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; Same paging setup as the BSP: 4MB global pages for the direct map. The
+    ; kernel directory identity maps this page until every AP is up.
+    mov eax, cr4
+    or eax, CR4_PSE | CR4_PGE
+    mov cr4, eax
+    mov eax, [TRAMPOLINE(ap_trampoline_cr3)]
+    mov cr3, eax
+    mov eax, cr0
+    or eax, CR0_PG | CR0_WP
+    mov cr0, eax
+
+    ; Kernel GDT and the stack the BSP allocated, then into the higher half
+    mov esp, [TRAMPOLINE(ap_trampoline_stack)]
+    mov ebx, [TRAMPOLINE(ap_trampoline_cpu)]
+    lgdt [gdt_descriptor]
+    jmp CODE_SEG:ap_higher_half
+
+align 8
+ap_gdt:
+    dq 0x0000000000000000       ; Null descriptor
+    dq 0x00CF9A000000FFFF       ; Flat code
+    dq 0x00CF92000000FFFF       ; Flat data
+ap_gdt_descriptor:
+    dw ap_gdt_descriptor - ap_gdt - 1
+    dd TRAMPOLINE(ap_gdt)
+
+; Parameters, written by smp_init() before each startup IPI
+align 4
+ap_trampoline_cr3:
+    dd 0
+ap_trampoline_stack:
+    dd 0
+ap_trampoline_cpu:
+    dd 0
+ap_trampoline_end:
+
+; Runs in place in the kernel image
+ap_higher_half:
+    mov ax, DATA_SEG
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov ss, ax
+
+    push 0
+    popf
+
+    push ebx        ; CPU number
+    call ap_main
+
+    ; ap_main() never returns
+    cli
+.hang:
+    hlt
+    jmp .hang
\ No newline at end of file
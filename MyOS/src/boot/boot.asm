@@ -9,6 +9,21 @@ MULTIBOOT_CHECKSUM  equ -(MULTIBOOT_MAGIC + MULTIBOOT_FLAGS)
 ; Stack size
 STACK_SIZE          equ 16384
 
+; Per-CPU GDT entries (keep in sync with smp.h)
+MAX_CPUS            equ 8
+
+; Higher half layout (keep in sync with memory.h)
+KERNEL_VIRTUAL_BASE equ 0xC0000000
+KERNEL_PAGE_NUMBER  equ (KERNEL_VIRTUAL_BASE >> 22)
+DIRECT_MAP_PDES     equ 192             ; 768MB of physical memory in 4MB pages
+
+; Paging bits
+PDE_4MB_KERNEL      equ 0x00000183      ; Present, write, 4MB page, global
+PDE_4MB_IDENTITY    equ 0x00000083      ; Present, write, 4MB page
+CR0_PG              equ 0x80000000
+CR4_PSE             equ 0x00000010
+CR4_PGE             equ 0x00000080
+
 section .multiboot
 align 4
     dd MULTIBOOT_MAGIC
@@ -21,11 +36,74 @@ stack_bottom:
     resb STACK_SIZE
 stack_top:
 
-section .text
+; Page directory used until paging_init() builds the kernel one
+section .bss.page_directory nobits alloc noexec write align=4096
+global boot_page_directory
+boot_page_directory:
+    resb 4096
+
+; Runs at the physical load address with paging disabled
+section .boot progbits alloc exec nowrite align=16
 global start
 extern kernel_main
 
 start:
+    ; EAX and EBX hold the multiboot magic and info pointer, keep them intact
+    
+    ; Enable 4MB pages
+    mov ecx, cr4
+    or ecx, CR4_PSE
+    mov cr4, ecx
+    
+    ; Identity map the first 4MB so the next instructions survive enabling paging
+    mov edi, boot_page_directory - KERNEL_VIRTUAL_BASE
+    mov dword [edi], PDE_4MB_IDENTITY
+    
+    ; Map low physical memory at KERNEL_VIRTUAL_BASE with global 4MB pages
+    xor ecx, ecx
+    mov edx, PDE_4MB_KERNEL
+.map_kernel:
+    mov [edi + KERNEL_PAGE_NUMBER * 4 + ecx * 4], edx
+    add edx, 0x400000
+    inc ecx
+    cmp ecx, DIRECT_MAP_PDES
+    jb .map_kernel
+    
+    mov cr3, edi
+    
+    ; Global pages survive CR3 reloads once CR4.PGE is set
+    mov ecx, cr4
+    or ecx, CR4_PGE
+    mov cr4, ecx
+    
+    ; Enable paging
+    mov ecx, cr0
+    or ecx, CR0_PG
+    mov cr0, ecx
+    
+    ; Jump to the higher half
+    lea ecx, [higher_half]
+    jmp ecx
+
+section .text
+
+higher_half:
+    ; Load our own GDT, the boot loader's one is only reachable through the identity map
+    lgdt [gdt_descriptor]
+    jmp CODE_SEG:.reload_segments
+.reload_segments:
+    mov cx, DATA_SEG
+    mov ds, cx
+    mov es, cx
+    mov fs, cx
+    mov gs, cx
+    mov ss, cx
+    
+    ; Drop the identity mapping and flush it from the TLB
+    mov dword [boot_page_directory], 0
+    mov ecx, cr3
+    mov cr3, ecx
+    
     ; Set up stack
     mov esp, stack_top
     
@@ -34,7 +112,8 @@ start:
     popf
     
     ; Call kernel main with multiboot parameters
-    push ebx        ; Multiboot info structure
+    add ebx, KERNEL_VIRTUAL_BASE
+    push ebx        ; Multiboot info structure (virtual address)
     push eax        ; Multiboot magic number
     call kernel_main
     add esp, 8      ; Clean up stack
@@ -48,6 +127,7 @@ start:
 ; Global Descriptor Table (GDT)
 section .data
 align 4
+global gdt_start
 gdt_start:
     ; Null descriptor
     dd 0x0
@@ -68,12 +148,37 @@ gdt_start:
     db 10010010b    ; Access byte
     db 11001111b    ; Granularity byte
     db 0x00         ; Base (bits 24-31)
+    
+    ; User code segment descriptor
+    dw 0xFFFF       ; Limit (bits 0-15)
+    dw 0x0000       ; Base (bits 0-15)
+    db 0x00         ; Base (bits 16-23)
+    db 11111010b    ; Access byte (DPL 3)
+    db 11001111b    ; Granularity byte
+    db 0x00         ; Base (bits 24-31)
+    
+    ; User data segment descriptor
+    dw 0xFFFF       ; Limit (bits 0-15)
+    dw 0x0000       ; Base (bits 0-15)
+    db 0x00         ; Base (bits 16-23)
+    db 11110010b    ; Access byte (DPL 3)
+    db 11001111b    ; Granularity byte
+    db 0x00         ; Base (bits 24-31)
+    
+    ; Per-CPU segment for GS and task state segment of each CPU, filled
+    ; in by smp_early_init() and tss_init()
+gdt_percpu:
+    times MAX_CPUS * 2 dq 0x0
 gdt_end:
 
+global gdt_descriptor
 gdt_descriptor:
     dw gdt_end - gdt_start - 1  ; Size
     dd gdt_start                ; Offset
 
 ; Code and data segment selectors
-CODE_SEG equ gdt_start + 8
-DATA_SEG equ gdt_start + 16
\ No newline at end of file
+CODE_SEG equ 0x08
+DATA_SEG equ 0x10
+USER_CODE_SEG equ 0x18
+USER_DATA_SEG equ 0x20
+PERCPU_SEG equ 0x28     ; Then the TSS at 0x30, one such pair per CPU
\ No newline at end of file
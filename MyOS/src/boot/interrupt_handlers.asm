@@ -84,9 +84,31 @@ IRQ 13, 45  ; FPU / Coprocessor / Inter-processor
 IRQ 14, 46  ; Primary ATA hard disk
 IRQ 15, 47  ; Secondary ATA hard disk
 
+; Local APIC vectors (apic.h)
+IRQ 16, 48  ; APIC timer
+IRQ 17, 49  ; Inter-processor interrupt
+
+; Spurious APIC interrupt: nothing to handle and no EOI to send
+global irq_spurious
+irq_spurious:
+    iret
+
 extern isr_handler
 extern irq_handler
 
+; GS stays on this CPU's per-CPU segment while in the kernel. Coming from
+; user mode it is null: reload it from the task register, each CPU's TSS
+; descriptor directly follows its per-CPU one (tss.h). The IRET back to
+; user mode nulls it again. Expects the saved CS at [esp + 48].
+%macro PERCPU_GS 0
+    test byte [esp + 48], 3
+    jz %%kernel
+    str ax
+    sub ax, 8
+    mov gs, ax
+%%kernel:
+%endmacro
+
 ; Common ISR stub
 isr_common_stub:
     pusha               ; Push all general purpose registers
@@ -98,15 +120,16 @@ isr_common_stub:
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
+    PERCPU_GS
     
+    push esp            ; Pass a pointer to the saved registers
     call isr_handler    ; Call C handler
+    add esp, 4
     
     pop eax             ; Restore original data segment descriptor
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
     
     popa                ; Pop all general purpose registers
     add esp, 8          ; Clean up pushed error code and ISR number
@@ -124,15 +147,16 @@ irq_common_stub:
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
+    PERCPU_GS
     
+    push esp            ; Pass a pointer to the saved registers
     call irq_handler    ; Call C handler
+    add esp, 4
     
     pop eax             ; Restore original data segment descriptor
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
     
     popa                ; Pop all general purpose registers
     add esp, 8          ; Clean up pushed error code and IRQ number
@@ -0,0 +1,36 @@
+; MyOS Context Switch
+; Kernel thread switching between process_t control blocks
+
+; process_t field offsets (keep in sync with process.h)
+PROCESS_ESP         equ 40
+PROCESS_EIP         equ 48
+
+section .text
+
+; void switch_to(process_t* prev, process_t* next)
+;
+; Saves the callee-saved registers on prev's kernel stack, records ESP and
+; the resume address in prev, then continues wherever next left off. The
+; caller-saved registers are already preserved by the C calling convention.
+; Address space and TSS updates are done by context_switch() beforehand.
+global switch_to
+switch_to:
+    mov eax, [esp + 4]          ; prev
+    mov edx, [esp + 8]          ; next
+    
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov [eax + PROCESS_ESP], esp
+    mov dword [eax + PROCESS_EIP], .resume
+    
+    mov esp, [edx + PROCESS_ESP]
+    jmp [edx + PROCESS_EIP]
+    
+.resume:
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
\ No newline at end of file
@@ -0,0 +1,258 @@
+; MyOS System Call Entry
+; int 0x80 and SYSENTER paths into syscall_handler(), and the way down to
+; user mode. See syscall.h for the register conventions. Both paths leave
+; the same syscall_frame_t at the top of the kernel stack.
+
+KERNEL_DATA_SEG equ 0x10
+USER_CODE_SEG   equ 0x1B
+USER_DATA_SEG   equ 0x23
+
+; Syscall numbers (keep in sync with syscall.h)
+SYS_EXIT        equ 1
+SYS_GETPID      equ 20
+
+section .text
+
+extern syscall_handler
+
+; Kernel data segments, and GS on this CPU's per-CPU segment. That one sits
+; just below the CPU's TSS descriptor (tss.h), so the task register finds it.
+; Clobbers bp.
+%macro KERNEL_SEGMENTS 0
+    mov bp, KERNEL_DATA_SEG
+    mov ds, bp
+    mov es, bp
+    mov fs, bp
+    str bp
+    sub bp, 8
+    mov gs, bp
+%endmacro
+
+; Push and pop the general and segment registers of syscall_frame_t
+%macro SAVE_USER_REGISTERS 0
+    push gs
+    push fs
+    push es
+    push ds
+    push ebp
+    push edi
+    push esi
+    push edx
+    push ecx
+    push ebx
+%endmacro
+
+%macro RESTORE_USER_REGISTERS 0
+    pop ebx
+    pop ecx
+    pop edx
+    pop esi
+    pop edi
+    pop ebp
+    pop ds
+    pop es
+    pop fs
+    pop gs
+%endmacro
+
+; int 0x80, through a DPL 3 interrupt gate
+global syscall_int80
+syscall_int80:
+    SAVE_USER_REGISTERS
+    KERNEL_SEGMENTS
+    sti
+    
+    push edx                ; arg3
+    push ecx                ; arg2
+    push ebx                ; arg1
+    push eax                ; Number
+    call syscall_handler
+    add esp, 16             ; Result stays in eax
+    
+    cli
+    RESTORE_USER_REGISTERS
+    iret
+
+; SYSENTER arrives with interrupts off and ESP pointing at this CPU's
+; tss.esp0 (syscall_init_cpu()), which holds the running task's kernel stack.
+; The return address and user stack go where int 0x80 has its IRET frame,
+; so a copy of the frame can go back to user mode through either exit.
+global syscall_sysenter
+syscall_sysenter:
+    mov esp, [esp]
+    push USER_DATA_SEG      ; ss
+    push ecx                ; esp
+    push dword 0x202        ; eflags, IF
+    push USER_CODE_SEG      ; cs
+    push edx                ; eip
+    SAVE_USER_REGISTERS
+    KERNEL_SEGMENTS
+    sti
+    
+    push edi                ; arg3
+    push esi                ; arg2
+    push ebx                ; arg1
+    push eax                ; Number
+    call syscall_handler
+    add esp, 16
+    
+    cli
+    RESTORE_USER_REGISTERS
+    pop edx                 ; eip
+    add esp, 8
+    pop ecx                 ; esp
+    sti                     ; Takes effect after the sysexit
+    sysexit
+
+; void syscall_return(syscall_frame_t* frame, uint32_t result)
+;
+; Back to user mode through a frame built by either entry path, with result
+; in eax. A forked child leaves the kernel this way for the first time.
+global syscall_return
+syscall_return:
+    cli
+    mov eax, [esp + 8]
+    mov esp, [esp + 4]
+    RESTORE_USER_REGISTERS
+    iret
+
+; void enter_user_mode(uint32_t eip, uint32_t esp)
+;
+; Leave the kernel for ring 3 with interrupts enabled. Never returns; the
+; next entry starts again at the top of the kernel stack (tss.esp0). The
+; IRET loads null into GS, the per-CPU segment is DPL 0.
+global enter_user_mode
+enter_user_mode:
+    cli
+    mov eax, [esp + 4]
+    mov ecx, [esp + 8]
+    mov dx, USER_DATA_SEG
+    mov ds, dx
+    mov es, dx
+    mov fs, dx
+    
+    push USER_DATA_SEG      ; ss
+    push ecx                ; esp
+    pushfd
+    or dword [esp], 0x200   ; IF
+    push USER_CODE_SEG      ; cs
+    push eax                ; eip
+    
+    ; Nothing of the kernel's is left in the registers
+    xor eax, eax
+    xor ebx, ebx
+    xor ecx, ecx
+    xor edx, edx
+    xor esi, esi
+    xor edi, edi
+    xor ebp, ebp
+    iret
+
+; User code of the system call benchmark, copied to SYSCALL_BENCH_ADDR in a
+; process of its own. It times SYS_GETPID round trips through each entry
+; path, then the same PID plus the clock read from the vDSO pages, leaves the
+; cycle counts in syscall_bench_data_t and exits.
+SYSCALL_BENCH_ADDR  equ 0x00400000
+BENCH_DATA          equ SYSCALL_BENCH_ADDR + 0x800
+
+; syscall_bench_data_t offsets (keep in sync with syscall.c)
+BENCH_INT80_ROUNDS      equ BENCH_DATA + 0
+BENCH_SYSENTER_ROUNDS   equ BENCH_DATA + 4
+BENCH_VDSO_ROUNDS       equ BENCH_DATA + 8
+BENCH_SYSCALL_PID       equ BENCH_DATA + 12
+BENCH_START             equ BENCH_DATA + 16
+BENCH_INT80_CYCLES      equ BENCH_DATA + 24
+BENCH_SYSENTER_CYCLES   equ BENCH_DATA + 32
+BENCH_VDSO_CYCLES       equ BENCH_DATA + 40
+BENCH_VDSO_PID          equ BENCH_DATA + 48
+BENCH_VDSO_US           equ BENCH_DATA + 52
+BENCH_DONE              equ BENCH_DATA + 56
+
+; vDSO pages and vdso_data_t offsets (keep in sync with vdso.h)
+VDSO_DATA_ADDR      equ 0xBFFFE000
+VDSO_TASK_ADDR      equ 0xBFFFF000
+VDSO_SEQ            equ VDSO_DATA_ADDR + 0
+VDSO_TSC_PER_US     equ VDSO_DATA_ADDR + 8
+VDSO_TSC_BASE       equ VDSO_DATA_ADDR + 16
+VDSO_US_BASE        equ VDSO_DATA_ADDR + 24
+
+section .rodata
+
+global syscall_bench_start
+global syscall_bench_end
+syscall_bench_start:
+    mov ebp, [BENCH_INT80_ROUNDS]
+    rdtsc
+    mov [BENCH_START], eax
+    mov [BENCH_START + 4], edx
+.int80:
+    mov eax, SYS_GETPID
+    int 0x80
+    dec ebp
+    jnz .int80
+    mov [BENCH_SYSCALL_PID], eax
+    rdtsc
+    sub eax, [BENCH_START]
+    sbb edx, [BENCH_START + 4]
+    mov [BENCH_INT80_CYCLES], eax
+    mov [BENCH_INT80_CYCLES + 4], edx
+    
+    mov ebp, [BENCH_SYSENTER_ROUNDS]
+    test ebp, ebp
+    jz .vdso
+    rdtsc
+    mov [BENCH_START], eax
+    mov [BENCH_START + 4], edx
+.sysenter:
+    mov eax, SYS_GETPID
+    mov ecx, esp
+    mov edx, SYSCALL_BENCH_ADDR + (.sysenter_return - syscall_bench_start)
+    sysenter
+.sysenter_return:
+    dec ebp
+    jnz .sysenter
+    rdtsc
+    sub eax, [BENCH_START]
+    sbb edx, [BENCH_START + 4]
+    mov [BENCH_SYSENTER_CYCLES], eax
+    mov [BENCH_SYSENTER_CYCLES + 4], edx
+    
+    ; vdso_getpid() and vdso_clock_us(), low 32 bits of the clock only
+.vdso:
+    mov ebp, [BENCH_VDSO_ROUNDS]
+    rdtsc
+    mov [BENCH_START], eax
+    mov [BENCH_START + 4], edx
+.vdso_round:
+    mov esi, [VDSO_SEQ]
+    test esi, 1
+    jnz .vdso_round         ; Kernel mid-update
+    mov edi, [VDSO_TASK_ADDR]
+    mov ebx, [VDSO_US_BASE]
+    mov ecx, [VDSO_TSC_PER_US]
+    jecxz .vdso_check       ; No TSC, microseconds of whole ticks
+    rdtsc
+    sub eax, [VDSO_TSC_BASE]
+    xor edx, edx
+    div ecx
+    add ebx, eax
+.vdso_check:
+    cmp esi, [VDSO_SEQ]
+    jne .vdso_round
+    dec ebp
+    jnz .vdso_round
+    rdtsc
+    sub eax, [BENCH_START]
+    sbb edx, [BENCH_START + 4]
+    mov [BENCH_VDSO_CYCLES], eax
+    mov [BENCH_VDSO_CYCLES + 4], edx
+    mov [BENCH_VDSO_PID], edi
+    mov [BENCH_VDSO_US], ebx
+
+.done:
+    mov dword [BENCH_DONE], 1
+    mov eax, SYS_EXIT
+    xor ebx, ebx
+    int 0x80
+    jmp $
+syscall_bench_end:
\ No newline at end of file
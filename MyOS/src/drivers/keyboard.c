@@ -1,6 +1,10 @@
 #include "keyboard.h"
 #include "interrupts.h"
 #include "kernel.h"
+#include "process.h"
+#include "cpu.h"
+#include "softirq.h"
+#include "sync.h"
 
 /* Keyboard state */
 static char keyboard_buffer[256];
@@ -8,6 +12,13 @@ static int buffer_head = 0;
 static int buffer_tail = 0;
 static int shift_pressed = 0;
 static int caps_lock = 0;
+static wait_queue_t keyboard_waiters;   /* Blocked in keyboard_getchar() */
+
+/* Raw scancodes from the interrupt, decoded by the bottom half */
+#define SCANCODE_RING_SIZE 32
+static uint8_t scancode_ring[SCANCODE_RING_SIZE];
+static volatile uint32_t scancode_head = 0;
+static volatile uint32_t scancode_tail = 0;
 
 /* US QWERTY keyboard layout */
 static char scancode_to_ascii[] = {
@@ -54,9 +65,7 @@ static char keyboard_buffer_get(void) {
     return c;
 }
 
-void keyboard_handler(void) {
-    uint8_t scancode = inb(KEYBOARD_DATA_PORT);
-    
+static void keyboard_decode(uint8_t scancode) {
     /* Handle key releases (bit 7 set) */
     if (scancode & 0x80) {
         scancode &= 0x7F;
@@ -99,26 +108,57 @@ void keyboard_handler(void) {
         }
         
         if (ascii) {
+            uint32_t flags = irq_save();
             keyboard_buffer_put(ascii);
+            wake_up_all(&keyboard_waiters);
+            irq_restore(flags);
         }
     }
 }
 
+static void keyboard_softirq(void) {
+    while (scancode_tail != scancode_head) {
+        uint8_t scancode = scancode_ring[scancode_tail % SCANCODE_RING_SIZE];
+        scancode_tail++;
+        keyboard_decode(scancode);
+    }
+}
+
+/* Top half: reading the data port acknowledges the controller */
+void keyboard_handler(void) {
+    uint8_t scancode = inb(KEYBOARD_DATA_PORT);
+    if (scancode_head - scancode_tail < SCANCODE_RING_SIZE) {
+        scancode_ring[scancode_head % SCANCODE_RING_SIZE] = scancode;
+        scancode_head++;
+    }
+    softirq_raise(SOFTIRQ_KEYBOARD);
+}
+
 void keyboard_init(void) {
     buffer_head = 0;
     buffer_tail = 0;
     shift_pressed = 0;
     caps_lock = 0;
+    wait_queue_init(&keyboard_waiters);
     
     /* Install keyboard interrupt handler */
+    softirq_register(SOFTIRQ_KEYBOARD, keyboard_softirq);
     interrupt_install_handler(33, keyboard_handler);
 }
 
 char keyboard_getchar(void) {
     char c;
+    uint32_t flags = irq_save();
     while ((c = keyboard_buffer_get()) == 0) {
-        __asm__ volatile ("hlt"); /* Wait for interrupt */
+        if (!process_get_current()) {
+            __asm__ volatile ("sti; hlt; cli"); /* No scheduler yet */
+            continue;
+        }
+        
+        /* Block so the idle task gets the CPU until a key arrives */
+        wait_queue_sleep(&keyboard_waiters);
     }
+    irq_restore(flags);
     return c;
 }
 
@@ -0,0 +1,47 @@
+#include "serial.h"
+#include "kernel.h"
+#include "vga.h"
+
+/* UART register offsets */
+#define SERIAL_DATA         0   /* Divisor low byte while DLAB is set */
+#define SERIAL_INT_ENABLE   1   /* Divisor high byte while DLAB is set */
+#define SERIAL_FIFO_CTRL    2
+#define SERIAL_LINE_CTRL    3
+#define SERIAL_MODEM_CTRL   4
+#define SERIAL_LINE_STATUS  5
+
+#define SERIAL_LINE_DLAB    0x80
+#define SERIAL_LINE_8N1     0x03
+#define SERIAL_STATUS_EMPTY 0x20    /* Transmit holding register empty */
+
+void serial_init(void) {
+    outb(SERIAL_COM1 + SERIAL_INT_ENABLE, 0x00);    /* Polled, no interrupts */
+    outb(SERIAL_COM1 + SERIAL_LINE_CTRL, SERIAL_LINE_DLAB);
+    outb(SERIAL_COM1 + SERIAL_DATA, 0x01);          /* 115200 baud */
+    outb(SERIAL_COM1 + SERIAL_INT_ENABLE, 0x00);
+    outb(SERIAL_COM1 + SERIAL_LINE_CTRL, SERIAL_LINE_8N1);
+    outb(SERIAL_COM1 + SERIAL_FIFO_CTRL, 0xC7);     /* Enable and clear FIFOs */
+    outb(SERIAL_COM1 + SERIAL_MODEM_CTRL, 0x03);    /* DTR and RTS */
+}
+
+void serial_putchar(char c) {
+    if (c == '\n') serial_putchar('\r');
+    
+    while (!(inb(SERIAL_COM1 + SERIAL_LINE_STATUS) & SERIAL_STATUS_EMPTY)) {
+        /* Wait for the transmitter */
+    }
+    outb(SERIAL_COM1 + SERIAL_DATA, c);
+}
+
+void serial_puts(const char* str) {
+    while (*str) {
+        serial_putchar(*str++);
+    }
+}
+
+void serial_printf(const char* format, ...) {
+    __builtin_va_list args;
+    __builtin_va_start(args, format);
+    print_format(serial_putchar, format, args);
+    __builtin_va_end(args);
+}
\ No newline at end of file
@@ -1,8 +1,10 @@
 #include "vga.h"
 #include "kernel.h"
+#include "memory.h"
+#include "cpu.h"
 
 /* VGA state */
-static uint16_t* vga_buffer = (uint16_t*)VGA_MEMORY;
+static uint16_t* vga_buffer = (uint16_t*)PHYS_TO_VIRT(VGA_MEMORY);
 static int vga_row = 0;
 static int vga_column = 0;
 static uint8_t vga_color = 0x0F; /* White on black */
@@ -20,7 +22,7 @@ void vga_init(void) {
     vga_row = 0;
     vga_column = 0;
     vga_color = vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-    vga_buffer = (uint16_t*)VGA_MEMORY;
+    vga_buffer = (uint16_t*)PHYS_TO_VIRT(VGA_MEMORY);
 }
 
 void vga_clear(void) {
@@ -61,7 +63,10 @@ static void vga_scroll(void) {
     vga_row = VGA_HEIGHT - 1;
 }
 
+/* Output from several CPUs is serialised by irq_save(), a whole string or
+ * format at a time */
 void vga_putchar(char c) {
+    uint32_t flags = irq_save();
     if (c == '\n') {
         vga_column = 0;
         if (++vga_row == VGA_HEIGHT) {
@@ -89,38 +94,49 @@ void vga_putchar(char c) {
             }
         }
     }
+    irq_restore(flags);
 }
 
 void vga_puts(const char* str) {
+    uint32_t flags = irq_save();
     while (*str) {
         vga_putchar(*str++);
     }
+    irq_restore(flags);
 }
 
-/* Simple printf implementation */
-static void print_string(const char* str) {
-    vga_puts(str);
+/* Simple printf implementation, supporting %[-][width]d/u/x/s/c */
+static void print_padded(void (*putc)(char), const char* str, int width, int left) {
+    int len = strlen(str);
+    
+    if (!left) {
+        while (len++ < width) putc(' ');
+    }
+    while (*str) putc(*str++);
+    if (left) {
+        while (len++ < width) putc(' ');
+    }
 }
 
-static void print_number(int num, int base) {
-    char buffer[32];
+static const char* format_number(char* buffer, int num, int base, int is_signed) {
     char* ptr = buffer + 31;
     int negative = 0;
+    uint32_t value = (uint32_t)num;
     
     *ptr = '\0';
     
     if (num == 0) {
         *(--ptr) = '0';
     } else {
-        if (num < 0 && base == 10) {
+        if (num < 0 && is_signed) {
             negative = 1;
-            num = -num;
+            value = -num;
         }
         
-        while (num > 0) {
-            int digit = num % base;
+        while (value > 0) {
+            int digit = value % base;
             *(--ptr) = (digit < 10) ? ('0' + digit) : ('A' + digit - 10);
-            num /= base;
+            value /= base;
         }
         
         if (negative) {
@@ -128,42 +144,69 @@ static void print_number(int num, int base) {
         }
     }
     
-    print_string(ptr);
+    return ptr;
 }
 
-void vga_printf(const char* format, ...) {
-    __builtin_va_list args;
-    __builtin_va_start(args, format);
+/* Shared by every console that formats output (VGA, serial) */
+void print_format(void (*putc)(char), const char* format, __builtin_va_list args) {
+    char buffer[32];
     
     while (*format) {
         if (*format == '%') {
             format++;
+            
+            int left = 0;
+            int width = 0;
+            if (*format == '-') {
+                left = 1;
+                format++;
+            }
+            while (*format >= '0' && *format <= '9') {
+                width = width * 10 + (*format - '0');
+                format++;
+            }
+            
             switch (*format) {
                 case 'd':
-                    print_number(__builtin_va_arg(args, int), 10);
+                    print_padded(putc, format_number(buffer, __builtin_va_arg(args, int), 10, 1), width, left);
+                    break;
+                case 'u':
+                    print_padded(putc, format_number(buffer, __builtin_va_arg(args, int), 10, 0), width, left);
                     break;
                 case 'x':
-                    print_number(__builtin_va_arg(args, int), 16);
+                    print_padded(putc, format_number(buffer, __builtin_va_arg(args, int), 16, 0), width, left);
                     break;
                 case 's':
-                    print_string(__builtin_va_arg(args, char*));
+                    print_padded(putc, __builtin_va_arg(args, char*), width, left);
                     break;
                 case 'c':
-                    vga_putchar(__builtin_va_arg(args, int));
+                    buffer[0] = (char)__builtin_va_arg(args, int);
+                    buffer[1] = '\0';
+                    print_padded(putc, buffer, width, left);
                     break;
                 case '%':
-                    vga_putchar('%');
+                    putc('%');
+                    break;
+                case '\0':
+                    format--;
                     break;
                 default:
-                    vga_putchar('%');
-                    vga_putchar(*format);
+                    putc('%');
+                    putc(*format);
                     break;
             }
         } else {
-            vga_putchar(*format);
+            putc(*format);
         }
         format++;
     }
-    
+}
+
+void vga_printf(const char* format, ...) {
+    __builtin_va_list args;
+    __builtin_va_start(args, format);
+    uint32_t flags = irq_save();
+    print_format(vga_putchar, format, args);
+    irq_restore(flags);
     __builtin_va_end(args);
 }
\ No newline at end of file
@@ -0,0 +1,67 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include "types.h"
+
+/* Common header of every ACPI system description table */
+typedef struct acpi_header {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+typedef struct acpi_rsdp {
+    char signature[8];              /* "RSD PTR " */
+    uint8_t checksum;               /* Over the first 20 bytes */
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+} __attribute__((packed)) acpi_rsdp_t;
+
+/* Multiple APIC description table ("APIC") */
+typedef struct acpi_madt {
+    acpi_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_t;
+
+#define MADT_LOCAL_APIC             0
+#define MADT_LAPIC_ADDRESS_OVERRIDE 5
+#define MADT_LAPIC_ENABLED          0x1
+
+typedef struct madt_entry {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) madt_entry_t;
+
+typedef struct madt_local_apic {
+    madt_entry_t entry;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed)) madt_local_apic_t;
+
+typedef struct madt_lapic_override {
+    madt_entry_t entry;
+    uint16_t reserved;
+    uint64_t address;
+} __attribute__((packed)) madt_lapic_override_t;
+
+/* Processors found in the MADT */
+#define ACPI_MAX_CPUS 8
+
+typedef struct acpi_smp_info {
+    uint32_t lapic_address;
+    uint32_t cpu_count;
+    uint8_t apic_ids[ACPI_MAX_CPUS];
+} acpi_smp_info_t;
+
+int acpi_find_cpus(acpi_smp_info_t* info);
+
+#endif
\ No newline at end of file
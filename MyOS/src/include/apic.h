@@ -0,0 +1,48 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include "types.h"
+
+/* Local APIC register offsets */
+#define LAPIC_ID            0x020
+#define LAPIC_TPR           0x080   /* Task priority */
+#define LAPIC_EOI           0x0B0
+#define LAPIC_SVR           0x0F0   /* Spurious vector, software enable */
+#define LAPIC_ICR_LOW       0x300
+#define LAPIC_ICR_HIGH      0x310
+#define LAPIC_LVT_TIMER     0x320
+#define LAPIC_LVT_LINT0     0x350
+#define LAPIC_LVT_LINT1     0x360
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE  0x3E0
+
+#define LAPIC_SVR_ENABLE        0x100
+#define LAPIC_LVT_MASKED        0x10000
+#define LAPIC_TIMER_PERIODIC    0x20000
+#define LAPIC_TIMER_DIVIDE_16   0x3
+
+/* Interrupt command register */
+#define ICR_INIT            0x00000500
+#define ICR_STARTUP         0x00000600
+#define ICR_DELIVERY_STATUS 0x00001000  /* Send pending */
+#define ICR_LEVEL_ASSERT    0x00004000
+#define ICR_LEVEL_TRIGGER   0x00008000
+
+/* Vectors above the remapped PIC range (32-47) */
+#define LAPIC_VECTOR_BASE   48
+#define LAPIC_TIMER_VECTOR  48
+#define IPI_VECTOR          49      /* Reschedule and TLB shootdown */
+#define SPURIOUS_VECTOR     0xFF
+
+int apic_init(uint32_t phys);
+void apic_init_cpu(void);
+uint32_t apic_id(void);
+void apic_eoi(void);
+void apic_send_ipi(uint32_t dest, uint32_t command);
+void apic_timer_calibrate(void);
+void apic_timer_start(void);
+void apic_timer_oneshot(uint32_t ticks);
+void apic_timer_handler(void);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,29 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "types.h"
+
+/* Arenas hand out memory by bumping a pointer through page sized chunks and
+ * release everything at once. Allocations are 8 byte aligned. */
+#define ARENA_ALIGN 8
+
+typedef struct arena_chunk {
+    struct arena_chunk* next;
+    uint32_t order;         /* Chunk spans 2^order pages */
+} arena_chunk_t;
+
+typedef struct arena {
+    arena_chunk_t* first;   /* Chunk holding this header */
+    arena_chunk_t* current; /* Chunk being bumped through */
+    uint32_t offset;        /* Next free byte in current */
+    uint32_t chunks;
+    uint32_t allocated;     /* Bytes handed out since the last reset */
+} arena_t;
+
+/* Arena functions */
+arena_t* arena_create(void);
+void* arena_alloc(arena_t* arena, uint32_t size);
+void arena_reset(arena_t* arena);
+void arena_destroy(arena_t* arena);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,14 @@
+#ifndef CMDLINE_H
+#define CMDLINE_H
+
+#include "types.h"
+
+#define CMDLINE_MAX_LENGTH  256
+#define CMDLINE_MAX_OPTIONS 16
+
+/* Kernel command line functions */
+void cmdline_init(const char* cmdline);
+const char* cmdline_get(const char* key);
+int cmdline_has(const char* key);
+
+#endif
\ No newline at end of file
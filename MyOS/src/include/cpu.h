@@ -0,0 +1,37 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include "types.h"
+
+#define EFLAGS_IF 0x200
+
+/* Set once the APs are running (smp.c). From then on every irq_save()
+ * section also holds the big kernel lock, so it still excludes everybody
+ * else that touches shared kernel state. */
+extern volatile int smp_active;
+void bkl_acquire(void);
+void bkl_release(void);
+
+/* Disable interrupts, returning the previous EFLAGS for irq_restore */
+static inline uint32_t irq_save(void) {
+    uint32_t flags;
+    __asm__ volatile ("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    if (smp_active) bkl_acquire();
+    return flags;
+}
+
+static inline void irq_restore(uint32_t flags) {
+    if (smp_active) bkl_release();
+    __asm__ volatile ("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile ("wrmsr" : : "c"(msr), "a"((uint32_t)value),
+                      "d"((uint32_t)(value >> 32)));
+}
+
+static inline void cpu_relax(void) {
+    __asm__ volatile ("pause" : : : "memory");
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,19 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include "types.h"
+#include "process.h"
+
+#define FPU_STATE_SIZE  512     /* FXSAVE image, must be 16-byte aligned */
+
+/* FPU/SSE state is switched lazily: context switches only set CR0.TS and the
+ * first FPU instruction of the next task traps to #NM, which saves the
+ * previous owner's registers and loads the new task's */
+void fpu_init(void);
+void fpu_init_cpu(void);
+void fpu_switch(process_t* prev, process_t* next);
+void fpu_fork(process_t* parent, process_t* child);
+void fpu_release(process_t* proc);
+void fpu_info(void);
+
+#endif
\ No newline at end of file
@@ -22,13 +22,26 @@ struct idt_ptr {
     uint32_t base;
 } __attribute__((packed));
 
+/* Register state pushed by the assembly stubs, lowest address first */
+typedef struct registers {
+    uint32_t ds;
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;   /* pusha */
+    uint32_t int_no, err_code;
+    uint32_t eip, cs, eflags, useresp, ss;              /* Pushed by the CPU */
+} registers_t;
+
 /* Interrupt handler type */
 typedef void (*interrupt_handler_t)(void);
 
+/* CPU exception handler type, gets the faulting register state */
+typedef void (*exception_handler_t)(registers_t* regs);
+
 /* Function prototypes */
 void idt_init(void);
+void idt_load(void);
 void idt_set_gate(uint8_t num, uint32_t base, uint16_t selector, uint8_t flags);
 void interrupt_install_handler(uint8_t interrupt, interrupt_handler_t handler);
+void exception_install_handler(uint8_t exception, exception_handler_t handler);
 
 /* Assembly interrupt handlers */
 extern void isr0(void);
@@ -81,5 +94,8 @@ extern void irq12(void);
 extern void irq13(void);
 extern void irq14(void);
 extern void irq15(void);
+extern void irq16(void);    /* Local APIC timer */
+extern void irq17(void);    /* Inter-processor interrupt */
+extern void irq_spurious(void);
 
 #endif /* INTERRUPTS_H */
\ No newline at end of file
@@ -36,9 +36,13 @@ char* strcat(char* dest, const char* src);
 int strcmp(const char* str1, const char* str2);
 void* memset(void* ptr, int value, size_t size);
 void* memcpy(void* dest, const void* src, size_t size);
+int memcmp(const void* ptr1, const void* ptr2, size_t size);
 
 /* Port I/O functions */
 uint8_t inb(uint16_t port);
 void outb(uint16_t port, uint8_t data);
 
+/* CPU functions */
+uint64_t rdtsc(void);
+
 #endif /* KERNEL_H */
\ No newline at end of file
@@ -8,18 +8,73 @@
 #define KERNEL_VIRTUAL_BASE 0xC0000000
 #define KERNEL_PAGE_NUMBER (KERNEL_VIRTUAL_BASE >> 22)
 
+/* Physical memory mapped at KERNEL_VIRTUAL_BASE with 4MB global pages
+ * (keep in sync with DIRECT_MAP_PDES in boot.asm) */
+#define KERNEL_DIRECT_MAP_SIZE 0x30000000
+#define KERNEL_DIRECT_MAP_PDES (KERNEL_DIRECT_MAP_SIZE >> 22)
+
+/* Recursive mapping: the last directory entry points at the directory itself,
+ * so the current page tables appear at PAGE_TABLES_VIRT. The entry below it is
+ * a window through which another directory's tables can be edited. */
+#define RECURSIVE_PDE           1023
+#define FOREIGN_PDE             1022
+#define PAGE_TABLES_VIRT        0xFFC00000
+#define PAGE_DIRECTORY_VIRT     0xFFFFF000
+#define FOREIGN_TABLES_VIRT     0xFF800000
+#define FOREIGN_DIRECTORY_VIRT  0xFFBFF000
+
+/* Batches larger than this flush the whole TLB instead of using invlpg */
+#define TLB_FLUSH_CEILING       32
+
+/* vmalloc space: kernel half above the direct map, below the windows.
+ * Unmapped areas are purged (TLB flushed, frames freed) in batches. */
+#define VMALLOC_START           (KERNEL_VIRTUAL_BASE + KERNEL_DIRECT_MAP_SIZE)
+#define VMALLOC_END             FOREIGN_TABLES_VIRT
+#define VMALLOC_LAZY_MAX_PAGES  512
+
+/* Conversions between physical and direct-mapped kernel addresses */
+#define PHYS_TO_VIRT(addr) ((void*)((uint32_t)(addr) + KERNEL_VIRTUAL_BASE))
+#define VIRT_TO_PHYS(addr) ((uint32_t)(addr) - KERNEL_VIRTUAL_BASE)
+
 /* Page directory and table entry flags */
 #define PAGE_PRESENT    0x001
 #define PAGE_WRITE      0x002
 #define PAGE_USER       0x004
+#define PAGE_WRITETHROUGH 0x008
+#define PAGE_NOCACHE    0x010   /* Uncached, for device registers */
 #define PAGE_ACCESSED   0x020
 #define PAGE_DIRTY      0x040
+#define PAGE_LARGE      0x080   /* 4MB page (directory entries, needs CR4.PSE) */
+#define PAGE_GLOBAL     0x100   /* Kept in the TLB across CR3 loads (needs CR4.PGE) */
+#define PAGE_COW        0x200   /* Software bit: read-only share of a writable page */
 
 /* Memory regions */
 #define MEMORY_KERNEL_START 0x100000
 #define MEMORY_KERNEL_END   0x400000
 #define MEMORY_USER_START   0x400000
 #define MEMORY_USER_END     0x800000
+#define KERNEL_HEAP_SIZE    0x400000
+
+/* Maximum number of boot memory map entries tracked */
+#define MAX_MEMORY_REGIONS  32
+
+/* Slab allocator size classes: 16, 32, ..., 2048 bytes */
+#define SLAB_MIN_SHIFT      4
+#define SLAB_MAX_SHIFT      11
+#define SLAB_MIN_SIZE       (1 << SLAB_MIN_SHIFT)
+#define SLAB_MAX_SIZE       (1 << SLAB_MAX_SHIFT)
+#define SLAB_CLASSES        (SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+
+/* Buddy allocator block orders: 4 KB up to 4 MB */
+#define BUDDY_MAX_ORDER     10
+
+/* Page frame flags */
+#define PAGE_FLAG_SLAB      0x001
+#define PAGE_FLAG_BUDDY     0x002   /* Head of a free buddy block */
+#define PAGE_FLAG_ZEROED    0x004   /* Cleared frame waiting in the zero pool */
+
+/* Pre-zeroed frames kept ready by the idle loop (zeropool=<n> overrides) */
+#define ZERO_POOL_WATERMARK 64
 
 typedef struct page_directory_entry {
     uint32_t present    : 1;
@@ -57,33 +112,119 @@ typedef struct page_table {
     page_table_entry_t entries[PAGE_ENTRIES];
 } page_table_t;
 
-/* Physical memory management */
+/* Kernel heap free list bins: bin i holds blocks of 2^(i+4) bytes and up */
+#define HEAP_MIN_BIN_SHIFT  4
+#define HEAP_BINS           20
+
+/* Kernel heap block header, placed directly in front of the payload.
+ * A copy of the size is stored right after the payload as a footer. */
 typedef struct memory_block {
-    uint32_t address;
-    uint32_t size;
-    int free;
-    struct memory_block* next;
+    uint32_t size;                  /* Payload size in bytes */
+    uint32_t free;
+    struct memory_block* next_free; /* Free list links, valid while free */
+    struct memory_block* prev_free;
 } memory_block_t;
 
+/* Per-frame descriptor, one for every physical page */
+typedef struct page {
+    uint32_t flags;
+    struct page* next;      /* List linkage (slab partial or buddy free list) */
+    struct page* prev;
+    void* freelist;         /* First free object in a slab page */
+    uint16_t inuse;         /* Objects allocated from a slab page */
+    uint8_t slab_class;     /* Size class of a slab page */
+    uint8_t order;          /* Buddy block order */
+    uint32_t refcount;      /* Address spaces mapping a user frame */
+} page_t;
+
+struct multiboot_info;
+
 /* Memory management functions */
-void memory_init(uint32_t mem_lower, uint32_t mem_upper);
+void memory_init(struct multiboot_info* mboot);
 void paging_init(void);
 void* kmalloc(uint32_t size);
 void kfree(void* ptr);
 void* vmalloc(uint32_t size);
 void vfree(void* ptr);
+void* ioremap(uint32_t phys, uint32_t size);
+void iounmap(void* ptr);
 
 /* Page management */
 uint32_t alloc_page(void);
 void free_page(uint32_t page);
-void map_page(uint32_t virtual_addr, uint32_t physical_addr, uint32_t flags);
+uint32_t alloc_pages(uint32_t order);
+void free_pages(uint32_t addr, uint32_t order);
+page_t* phys_to_page(uint32_t addr);
+uint32_t page_to_phys(page_t* page);
+void page_ref(uint32_t addr);
+void page_unref(uint32_t addr);
+int map_page(uint32_t virtual_addr, uint32_t physical_addr, uint32_t flags);
 void unmap_page(uint32_t virtual_addr);
+void map_page_in(page_directory_t* dir, uint32_t virtual_addr, uint32_t physical_addr, uint32_t flags);
+int map_range(uint32_t virtual_addr, uint32_t physical_addr, uint32_t count, uint32_t flags);
+void unmap_range(uint32_t virtual_addr, uint32_t count);
+page_table_entry_t* get_page_entry(page_directory_t* dir, uint32_t virtual_addr, uint32_t create_flags);
 page_directory_t* create_page_directory(void);
+page_directory_t* clone_page_directory(void);
+void free_page_directory(page_directory_t* dir);
 void switch_page_directory(page_directory_t* dir);
+void tlb_flush_all(void);
+void tlb_flush_range(uint32_t virtual_addr, uint32_t count);
+page_directory_t* current_page_directory(void);
+page_directory_t* kernel_page_directory(void);
+void page_fault_init(void);
+
+/* Physical frame allocator backend */
+typedef struct frame_allocator {
+    const char* name;
+    uint32_t (*metadata_size)(uint32_t total_pages);
+    void (*init)(uint32_t total_pages, uint32_t metadata);
+    void (*add_range)(uint32_t start, uint32_t end);
+    uint32_t (*alloc)(uint32_t order);
+    void (*free)(uint32_t addr, uint32_t order);
+    uint32_t (*free_pages)(void);
+    void (*info)(void);
+} frame_allocator_t;
+
+extern const frame_allocator_t buddy_frame_allocator;
+extern const frame_allocator_t bitmap_frame_allocator;
+
+/* Buddy allocator */
+uint32_t buddy_metadata_size(uint32_t total_pages);
+void buddy_init(uint32_t total_pages, uint32_t metadata);
+void buddy_add_range(uint32_t start, uint32_t end);
+uint32_t buddy_alloc(uint32_t order);
+void buddy_free(uint32_t addr, uint32_t order);
+uint32_t buddy_free_pages(void);
+void buddy_info(void);
+
+/* Slab allocator */
+void slab_init(void);
+void* slab_alloc(uint32_t size);
+void slab_free(void* ptr);
+void slab_info(void);
+
+/* Pre-zeroed frame pool */
+void zero_pool_init(void);
+uint32_t alloc_zeroed_page(void);
+int zero_pool_refill(void);
+void zero_pool_info(void);
+
+#ifdef CONFIG_KMALLOC_PROFILE
+/* Per-callsite kmalloc profiler (KMALLOC_PROFILE=1) */
+void kmalloc_profile_alloc(void* ptr, uint32_t size, void* caller);
+void kmalloc_profile_free(void* ptr);
+void kmalloc_profile_report(uint32_t min_age_seconds);
+#endif
+
+/* Virtually contiguous kernel allocations */
+void vmalloc_purge(void);
+void vmalloc_info(void);
 
 /* Memory information */
 void memory_info(void);
 uint32_t get_free_memory(void);
 uint32_t get_used_memory(void);
+void heap_get_stats(uint32_t* free_bytes, uint32_t* largest_free);
 
 #endif
\ No newline at end of file
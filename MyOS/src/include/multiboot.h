@@ -0,0 +1,60 @@
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include "types.h"
+
+/* Multiboot information flags */
+#define MULTIBOOT_INFO_MEMORY   0x001
+#define MULTIBOOT_INFO_CMDLINE  0x004
+#define MULTIBOOT_INFO_MODS     0x008
+#define MULTIBOOT_INFO_MEM_MAP  0x040
+
+/* Memory map entry types */
+#define MULTIBOOT_MEMORY_AVAILABLE  1
+#define MULTIBOOT_MEMORY_RESERVED   2
+#define MULTIBOOT_MEMORY_ACPI       3
+#define MULTIBOOT_MEMORY_NVS        4
+#define MULTIBOOT_MEMORY_BADRAM     5
+
+/* Multiboot information structure */
+struct multiboot_info {
+    uint32_t flags;
+    uint32_t mem_lower;
+    uint32_t mem_upper;
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t syms[4];
+    uint32_t mmap_length;
+    uint32_t mmap_addr;
+    uint32_t drives_length;
+    uint32_t drives_addr;
+    uint32_t config_table;
+    uint32_t boot_loader_name;
+    uint32_t apm_table;
+    uint32_t vbe_control_info;
+    uint32_t vbe_mode_info;
+    uint16_t vbe_mode;
+    uint16_t vbe_interface_seg;
+    uint16_t vbe_interface_off;
+    uint16_t vbe_interface_len;
+} __attribute__((packed));
+
+/* Memory map entry; size does not include the size field itself */
+typedef struct multiboot_mmap_entry {
+    uint32_t size;
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+} __attribute__((packed)) multiboot_mmap_entry_t;
+
+/* Boot module descriptor */
+typedef struct multiboot_module {
+    uint32_t mod_start;
+    uint32_t mod_end;
+    uint32_t cmdline;
+    uint32_t reserved;
+} __attribute__((packed)) multiboot_module_t;
+
+#endif /* MULTIBOOT_H */
\ No newline at end of file
@@ -2,15 +2,34 @@
 #define PROCESS_H
 
 #include "types.h"
+#include "timer.h"
+#include "rbtree.h"
+#include "sync.h"
 
-#define MAX_PROCESSES 64
-#define STACK_SIZE 4096
+struct syscall_frame;
+
+#define PID_MAX 32768            /* PIDs are 1..PID_MAX-1 */
+#define PID_HASH_BITS 12        /* A bucket per 8 PIDs of the PID space */
+#define STACK_SIZE 4096         /* Kernel stack, vmalloc'd with a guard page */
 #define PROCESS_NAME_LEN 32
+#define SCHED_PRIORITIES 32     /* Priority levels, higher runs first */
+#define EXIT_FAULT 128          /* Plus the vector, for a task killed by an exception */
+
+/* Process flags */
+#define PROCESS_IDLE    0x1     /* A CPU's idle task */
+#define PROCESS_PINNED  0x2     /* Never migrates: idle tasks and own address spaces */
+
+/* Per-process address space layout, populated on demand by the page fault handler */
+#define USER_STACK_TOP      0xBFFFE000  /* Just below the vDSO pages (vdso.h) */
+#define USER_STACK_SIZE     0x00100000  /* 1MB reserved, pages appear as they are touched */
+#define USER_HEAP_START     0x40000000
+#define USER_HEAP_MAX_SIZE  0x40000000  /* Upper bound on heap growth */
 
 typedef enum {
     PROCESS_READY,
     PROCESS_RUNNING,
     PROCESS_BLOCKED,
+    PROCESS_ZOMBIE,         /* Exited, resources not yet released */
     PROCESS_TERMINATED
 } process_state_t;
 
@@ -18,45 +37,75 @@ typedef struct process {
     uint32_t pid;
     char name[PROCESS_NAME_LEN];
     process_state_t state;
-    uint32_t esp;           /* Stack pointer */
+    uint32_t esp;           /* Saved kernel stack pointer (switch.asm offset) */
     uint32_t ebp;           /* Base pointer */
-    uint32_t eip;           /* Instruction pointer */
+    uint32_t eip;           /* Resume address (switch.asm offset) */
     uint32_t page_directory; /* Page directory physical address */
-    uint32_t stack_base;    /* Stack base address */
+    uint32_t kernel_stack;  /* Kernel stack base, 0 for the boot thread */
+    uint32_t stack_base;    /* Stack base address (demand paged) */
     uint32_t heap_start;    /* Heap start address */
-    uint32_t heap_end;      /* Heap end address */
-    uint32_t priority;      /* Process priority */
+    uint32_t heap_end;      /* Heap end address (demand paged up to here) */
+    uint32_t priority;      /* Effective priority, raised by priority inheritance */
     uint32_t time_slice;    /* Time slice remaining */
     uint32_t total_time;    /* Total CPU time used */
-    struct process* next;   /* Next process in queue */
+    uint32_t minor_faults;  /* Pages populated by demand paging */
+    struct process* next;   /* Run queue linkage */
+    struct process* prev;
+    struct process* hash_next;  /* PID hash chain */
+    struct process* task_next;  /* List of every process */
+    struct process* task_prev;
+    timer_event_t sleep_timer;  /* Wakes the process from process_sleep() */
+    void* fpu_state;        /* FXSAVE area, allocated on first FPU use */
+    uint32_t vruntime;      /* Weighted CPU time in us (fair policy) */
+    rb_node_t run_node;     /* Fair policy run queue linkage */
+    uint32_t flags;         /* PROCESS_IDLE, PROCESS_PINNED */
+    uint32_t cpu;           /* CPU it runs on or is queued for */
+    uint32_t lock_depth;    /* Big kernel lock nesting while switched out */
+    uint32_t base_priority; /* Priority it was given */
+    struct process* wait_next;  /* Wait queue linkage */
+    wait_queue_t* waiting_on;   /* Wait queue it sleeps on, if any */
+    mutex_t* blocked_on;    /* Mutex it is waiting for */
+    mutex_t* held_mutexes;  /* Mutexes it owns, for priority inheritance */
 } process_t;
 
 /* Process management functions */
 void process_init(void);
+void process_init_cpu(uint32_t kernel_stack);
 uint32_t process_create(const char* name, void (*entry_point)(void), uint32_t priority);
+uint32_t kthread_create(const char* name, void (*entry_point)(void), uint32_t priority);
+void process_pin(process_t* proc);
+void process_set_priority(process_t* proc, uint32_t priority);
 void process_exit(uint32_t exit_code);
 void process_yield(void);
+void process_block(void);
+void process_wake(process_t* proc);
 void process_sleep(uint32_t ms);
+void process_sleep_info(void);
 process_t* process_get_current(void);
 process_t* process_get_by_pid(uint32_t pid);
 void process_list(void);
+uint32_t process_sbrk(int32_t increment);
+uint32_t process_fork(const struct syscall_frame* frame);
+void process_fork_benchmark(void);
 
 /* Scheduler functions */
 void scheduler_init(void);
-void scheduler_tick(void);
+void scheduler_tick(uint32_t ticks);
+void scheduler_preempt(void);
+int scheduler_runnable(void);
 void schedule(void);
-void context_switch(process_t* next);
-
-/* System call interface */
-#define SYS_EXIT    1
-#define SYS_FORK    2
-#define SYS_READ    3
-#define SYS_WRITE   4
-#define SYS_OPEN    5
-#define SYS_CLOSE   6
-#define SYS_GETPID  20
-#define SYS_SLEEP   35
-
-uint32_t syscall_handler(uint32_t syscall_num, uint32_t arg1, uint32_t arg2, uint32_t arg3);
+void context_switch(process_t* prev, process_t* next);
+void switch_to(process_t* prev, process_t* next);  /* switch.asm */
+void process_switch_benchmark(void);
+
+/* Fair scheduling class (sched_fair.c), selected with sched=cfs */
+void fair_task_init(process_t* proc);
+void fair_enqueue(process_t* proc);
+void fair_dequeue(process_t* proc);
+process_t* fair_pick(uint32_t cpu);
+int fair_runnable(uint32_t cpu);
+void fair_account(process_t* curr, uint32_t ticks);
+uint32_t fair_timeslice(process_t* proc);
+void fair_info(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,30 @@
+#ifndef RBTREE_H
+#define RBTREE_H
+
+#include "types.h"
+
+/* Intrusive red-black tree. Callers embed an rb_node_t, walk down from the
+ * root to find the insertion point themselves, then call rb_insert. */
+#define RB_RED      0
+#define RB_BLACK    1
+
+typedef struct rb_node {
+    struct rb_node* parent;
+    struct rb_node* left;
+    struct rb_node* right;
+    int color;
+} rb_node_t;
+
+typedef struct rb_root {
+    rb_node_t* node;
+} rb_root_t;
+
+#define rb_entry(ptr, type, member) \
+    ((type*)((char*)(ptr) - __builtin_offsetof(type, member)))
+
+void rb_insert(rb_node_t* node, rb_node_t* parent, rb_node_t** link, rb_root_t* root);
+void rb_erase(rb_node_t* node, rb_root_t* root);
+rb_node_t* rb_first(rb_root_t* root);
+rb_node_t* rb_next(rb_node_t* node);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,14 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include "types.h"
+
+#define SERIAL_COM1 0x3F8
+
+/* Serial port functions (COM1, polled) */
+void serial_init(void);
+void serial_putchar(char c);
+void serial_puts(const char* str);
+void serial_printf(const char* format, ...);
+
+#endif
\ No newline at end of file
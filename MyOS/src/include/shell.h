@@ -33,6 +33,19 @@ int cmd_rmdir(int argc, char* argv[]);
 int cmd_cd(int argc, char* argv[]);
 int cmd_pwd(int argc, char* argv[]);
 int cmd_free(int argc, char* argv[]);
+int cmd_forkbench(int argc, char* argv[]);
+int cmd_arenabench(int argc, char* argv[]);
+int cmd_switchbench(int argc, char* argv[]);
+int cmd_timers(int argc, char* argv[]);
+int cmd_softirqs(int argc, char* argv[]);
+int cmd_cpus(int argc, char* argv[]);
+int cmd_smpbench(int argc, char* argv[]);
+int cmd_locks(int argc, char* argv[]);
+int cmd_syncbench(int argc, char* argv[]);
+int cmd_syscallbench(int argc, char* argv[]);
+#ifdef CONFIG_KMALLOC_PROFILE
+int cmd_kmprof(int argc, char* argv[]);
+#endif
 int cmd_uptime(int argc, char* argv[]);
 int cmd_uname(int argc, char* argv[]);
 int cmd_whoami(int argc, char* argv[]);
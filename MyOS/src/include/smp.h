@@ -0,0 +1,58 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "types.h"
+
+#define MAX_CPUS            8       /* Keep in sync with boot.asm */
+#define AP_TRAMPOLINE_PHYS  0x8000  /* Real mode entry of the APs, below 1MB */
+#define AP_BOOT_TIMEOUT_MS  100
+
+struct process;
+struct page_directory;
+
+/* Per-CPU data. The GS segment of each CPU is based at its own cpu_t, whose
+ * first word points back at itself, so this_cpu() is a single load. */
+typedef struct cpu {
+    struct cpu* self;
+    uint32_t id;                    /* Index into cpus[], 0 is the BSP */
+    uint32_t apic_id;
+    volatile int online;
+    struct process* current;
+    struct process* idle;
+    volatile int need_resched;      /* Switch on the next interrupt exit */
+    uint32_t lock_depth;            /* Big kernel lock nesting, see bkl_acquire() */
+    volatile int tlb_flush;         /* Shootdown requested by another CPU */
+    volatile uint32_t softirq_pending;
+    int softirq_active;
+    struct process* fpu_owner;      /* Task whose FPU state is in the registers */
+    struct page_directory* directory;   /* Loaded in CR3 */
+    struct page_directory* foreign;     /* In the FOREIGN_PDE window of directory */
+    uint32_t ticks;                 /* Scheduler ticks taken on this CPU */
+    volatile int timer_oneshot;     /* APIC tick stopped for an idle halt (APs) */
+    uint64_t idle_tsc;              /* When it was stopped */
+    uint32_t idle_ticks;
+    uint32_t ipis;                  /* IPIs received */
+} cpu_t;
+
+extern cpu_t cpus[MAX_CPUS];
+extern uint32_t smp_cpu_count;
+
+static inline cpu_t* this_cpu(void) {
+    cpu_t* cpu;
+    __asm__ volatile ("movl %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+void smp_early_init(void);
+void bkl_drop(void);
+void smp_init(void);
+void smp_send_reschedule(uint32_t cpu);
+void smp_tlb_shootdown(void);
+void smp_ipi_handler(void);
+void smp_info(void);
+void smp_benchmark(uint32_t threads);
+
+/* Arch entry of the APs (ap_boot.asm) */
+void ap_main(uint32_t cpu_id);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,31 @@
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include "types.h"
+
+/* Bottom halves. Interrupt handlers only acknowledge the device and raise a
+ * softirq; the real work runs on interrupt exit with interrupts enabled. */
+#define SOFTIRQ_TIMER       0
+#define SOFTIRQ_KEYBOARD    1
+#define SOFTIRQ_COUNT       2
+#define SOFTIRQ_MAX_RESTART 10      /* Rounds before ksoftirqd takes over */
+#define SOFTIRQ_THREAD_PRIORITY 1
+
+/* Deferred work that may take a while, run by the kworker thread */
+typedef struct work {
+    void (*func)(void* data);
+    void* data;
+    int pending;
+    struct work* next;
+} work_t;
+
+void softirq_init(void);
+void softirq_register(uint32_t nr, void (*handler)(void));
+void softirq_raise(uint32_t nr);
+void softirq_run(void);
+void irq_exit(void);
+void work_init(work_t* work, void (*func)(void* data), void* data);
+void work_queue(work_t* work);
+void softirq_info(void);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,77 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include "types.h"
+
+/* Blocking synchronization for task context. A waiter is BLOCKED and off
+ * every run queue until it is woken, so it costs no CPU time. None of these
+ * may be used from an interrupt handler or softirq except the wake calls. */
+#define MUTEX_SPIN_LIMIT    4096    /* pause iterations before blocking */
+#define MUTEX_PI_DEPTH      8       /* Owner chain followed when lending priority */
+
+struct process;
+
+/* Tasks waiting for an event, highest priority first, FIFO within a level */
+typedef struct wait_queue {
+    struct process* head;
+} wait_queue_t;
+
+/* Contention statistics of a named lock, listed by sync_info() */
+typedef struct lock_stat {
+    const char* name;
+    const char* type;
+    uint32_t acquisitions;
+    uint32_t contended;         /* Acquisitions that had to wait */
+    uint32_t spun;              /* Contended ones that only spun */
+    uint32_t wait_us;           /* Total time spent waiting */
+    uint32_t max_wait_us;
+    struct lock_stat* next;
+} lock_stat_t;
+
+/* Sleeping mutex with adaptive spinning and priority inheritance. Unlock
+ * hands it straight to the first waiter. */
+typedef struct mutex {
+    struct process* volatile owner;
+    volatile uint32_t owner_cpu;    /* Where the owner took it */
+    wait_queue_t waiters;
+    struct mutex* held_next;        /* Owner's list of held mutexes */
+    lock_stat_t stat;
+} mutex_t;
+
+typedef struct semaphore {
+    volatile int32_t count;
+    wait_queue_t waiters;
+    lock_stat_t stat;
+} semaphore_t;
+
+/* Always used with a mutex that protects the condition */
+typedef struct condvar {
+    wait_queue_t waiters;
+} condvar_t;
+
+void wait_queue_init(wait_queue_t* queue);
+int wait_queue_sleep(wait_queue_t* queue);
+struct process* wake_up_one(wait_queue_t* queue);
+void wake_up_all(wait_queue_t* queue);
+
+/* A NULL name keeps the lock out of the contention report; named locks
+ * must live forever */
+void mutex_init(mutex_t* mutex, const char* name);
+void mutex_lock(mutex_t* mutex);
+int mutex_trylock(mutex_t* mutex);
+void mutex_unlock(mutex_t* mutex);
+
+void sem_init(semaphore_t* sem, int32_t count, const char* name);
+void sem_down(semaphore_t* sem);
+int sem_trydown(semaphore_t* sem);
+void sem_up(semaphore_t* sem);
+
+void cond_init(condvar_t* cond);
+void cond_wait(condvar_t* cond, mutex_t* mutex);
+void cond_signal(condvar_t* cond);
+void cond_broadcast(condvar_t* cond);
+
+void sync_info(void);
+void sync_benchmark(void);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,49 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include "types.h"
+
+/*
+ * System call ABI. The number goes in eax and the result comes back there.
+ *   int 0x80  arguments in ebx, ecx, edx; all other registers preserved
+ *   sysenter  arguments in ebx, esi, edi; ecx must hold the user stack
+ *             pointer and edx the address to return to, both clobbered
+ */
+#define SYSCALL_VECTOR  0x80
+
+#define SYS_EXIT    1
+#define SYS_FORK    2
+#define SYS_READ    3
+#define SYS_WRITE   4
+#define SYS_OPEN    5
+#define SYS_CLOSE   6
+#define SYS_GETPID  20
+#define SYS_SLEEP   35
+#define SYS_SBRK    45
+#define SYSCALL_COUNT 64        /* Size of the dispatch table */
+
+/* The benchmark's user code page (syscall_entry.asm) */
+#define SYSCALL_BENCH_ADDR  0x00400000
+#define SYSCALL_BENCH_DATA  0x800   /* Offset of syscall_bench_data_t in it */
+#define SYSCALL_BENCH_ROUNDS 10000
+
+/* User registers both entry paths save at the top of the kernel stack,
+ * lowest address first. The result goes back in eax, which is not saved. */
+typedef struct syscall_frame {
+    uint32_t ebx, ecx, edx, esi, edi, ebp;
+    uint32_t ds, es, fs, gs;
+    uint32_t eip, cs, eflags, esp, ss;  /* IRET frame */
+} syscall_frame_t;
+
+void syscall_init(void);
+void syscall_init_cpu(void);
+uint32_t syscall_handler(uint32_t syscall_num, uint32_t arg1, uint32_t arg2, uint32_t arg3);
+void syscall_benchmark(void);
+
+/* syscall_entry.asm */
+void syscall_int80(void);
+void syscall_sysenter(void);
+void enter_user_mode(uint32_t eip, uint32_t esp);
+void syscall_return(syscall_frame_t* frame, uint32_t result);
+
+#endif
\ No newline at end of file
@@ -5,13 +5,44 @@
 
 #define TIMER_FREQUENCY 1000  /* 1000 Hz = 1ms per tick */
 #define PIT_FREQUENCY 1193180 /* PIT base frequency */
+#define PIT_TICK_COUNT (PIT_FREQUENCY / TIMER_FREQUENCY)
+#define TIMER_ONESHOT_MAX (0xFFFF / PIT_TICK_COUNT)  /* Longest one-shot in ticks */
 
 /* Timer functions */
 void timer_init(void);
 void timer_handler(void);
 uint32_t timer_get_ticks(void);
+uint32_t timer_tsc_per_tick(void);
 uint32_t timer_get_seconds(void);
 void timer_sleep(uint32_t ms);
+void timer_udelay(uint32_t us);
+uint32_t timer_tsc_to_us(uint64_t cycles);
+void timer_idle_enter(void);
+void timer_idle_exit(void);
+void timer_nohz_kick(uint32_t expires);
+void timer_info(void);
+
+/* Hierarchical timer wheel: TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SLOTS
+ * slots, each level covering 64 times the span of the one below */
+#define TIMER_WHEEL_BITS    6
+#define TIMER_WHEEL_SLOTS   (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS  4
+#define TIMER_WHEEL_MAX     ((1u << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+typedef struct timer_event {
+    uint32_t expires;               /* Tick at which the callback runs */
+    void (*callback)(void* data);   /* Called from the timer softirq */
+    void* data;
+    struct timer_event* next;
+    struct timer_event* prev;
+    struct timer_event** slot;      /* Owning slot, NULL when not pending */
+} timer_event_t;
+
+void timer_event_add(timer_event_t* event, uint32_t expires);
+void timer_event_cancel(timer_event_t* event);
+void timer_wheel_run(uint32_t now);
+uint32_t timer_wheel_next(uint32_t limit);
+void timer_wheel_info(void);
 
 /* System time structure */
 typedef struct {
@@ -0,0 +1,45 @@
+#ifndef TSS_H
+#define TSS_H
+
+#include "types.h"
+
+/* GDT selectors, laid out in boot.asm */
+#define KERNEL_CODE_SELECTOR    0x08
+#define KERNEL_DATA_SELECTOR    0x10
+#define USER_CODE_SELECTOR      0x1B
+#define USER_DATA_SELECTOR      0x23
+
+/* Then one pair per CPU: a data segment based at its cpu_t (loaded into
+ * GS), followed by its TSS */
+#define PERCPU_SELECTOR(cpu)    (0x28 + (cpu) * 16)
+#define TSS_SELECTOR(cpu)       (0x30 + (cpu) * 16)
+
+/* Hardware task state segment. Only ss0/esp0 are used: the stack the CPU
+ * switches to when an interrupt arrives in user mode. */
+typedef struct tss {
+    uint32_t prev_task;
+    uint32_t esp0;
+    uint32_t ss0;
+    uint32_t esp1;
+    uint32_t ss1;
+    uint32_t esp2;
+    uint32_t ss2;
+    uint32_t cr3;
+    uint32_t eip;
+    uint32_t eflags;
+    uint32_t eax, ecx, edx, ebx;
+    uint32_t esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs;
+    uint32_t ldt;
+    uint16_t trap;
+    uint16_t iomap_base;
+} __attribute__((packed)) tss_t;
+
+/* TSS functions, acting on the calling CPU */
+void tss_init(void);
+void tss_set_kernel_stack(uint32_t esp0);
+tss_t* tss_current(void);
+void gdt_set_entry(uint32_t selector, uint32_t base, uint32_t limit,
+                   uint8_t access, uint8_t granularity);
+
+#endif
\ No newline at end of file
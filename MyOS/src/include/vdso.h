@@ -0,0 +1,79 @@
+#ifndef VDSO_H
+#define VDSO_H
+
+#include "types.h"
+#include "timer.h"
+#include "memory.h"
+
+/*
+ * Read-only pages mapped at the top of every user address space, so user
+ * code can read the clock and its own PID without entering the kernel.
+ * The clock page is one frame shared by everybody and updated by the timer
+ * bottom half; the task page belongs to the process.
+ */
+#define VDSO_DATA_ADDR  0xBFFFE000
+#define VDSO_TASK_ADDR  0xBFFFF000
+
+/* Clock page. The kernel makes seq odd while it writes; a reader retries
+ * until it sees the same even value before and after its reads. */
+typedef struct vdso_data {
+    volatile uint32_t seq;
+    uint32_t ticks;             /* Monotonic, TIMER_FREQUENCY per second */
+    uint32_t tsc_per_us;        /* 0 without a calibrated TSC */
+    uint32_t reserved;
+    uint64_t tsc_base;          /* TSC at which the clock read us_base */
+    uint64_t us_base;           /* Monotonic microseconds since boot */
+    system_time_t wall;         /* Wall clock, to the second */
+} vdso_data_t;                  /* Offsets used by syscall_entry.asm */
+
+typedef struct vdso_task {
+    uint32_t pid;
+} vdso_task_t;
+
+void vdso_init(void);
+int vdso_map(page_directory_t* dir, uint32_t pid);
+void vdso_update(uint32_t ticks);
+void vdso_info(void);
+
+/* User-mode readers. Between kernel updates the TSC interpolates the
+ * clock; the kernel only ever moves tsc_base by whole microseconds, so the
+ * result never goes backwards. */
+static inline uint32_t vdso_getpid(void) {
+    return ((const volatile vdso_task_t*)VDSO_TASK_ADDR)->pid;
+}
+
+static inline uint64_t vdso_clock_us(void) {
+    const volatile vdso_data_t* data = (const volatile vdso_data_t*)VDSO_DATA_ADDR;
+    uint32_t seq;
+    uint64_t us;
+    do {
+        seq = data->seq;
+        if (seq & 1) continue;
+        __asm__ volatile ("" : : : "memory");
+        
+        us = data->us_base;
+        if (data->tsc_per_us) {
+            uint32_t low, high;
+            __asm__ volatile ("rdtsc" : "=a"(low), "=d"(high));
+            uint64_t delta = (((uint64_t)high << 32) | low) - data->tsc_base;
+            us += (uint32_t)delta / data->tsc_per_us;
+        }
+        __asm__ volatile ("" : : : "memory");
+    } while ((seq & 1) || data->seq != seq);
+    return us;
+}
+
+static inline system_time_t vdso_wall_time(void) {
+    const volatile vdso_data_t* data = (const volatile vdso_data_t*)VDSO_DATA_ADDR;
+    uint32_t seq;
+    system_time_t wall;
+    do {
+        seq = data->seq;
+        __asm__ volatile ("" : : : "memory");
+        wall = *(const system_time_t*)&data->wall;
+        __asm__ volatile ("" : : : "memory");
+    } while ((seq & 1) || data->seq != seq);
+    return wall;
+}
+
+#endif
\ No newline at end of file
@@ -37,5 +37,6 @@ void vga_puts(const char* str);
 void vga_printf(const char* format, ...);
 void vga_set_color(vga_color_t fg, vga_color_t bg);
 void vga_set_cursor(int x, int y);
+void print_format(void (*putc)(char), const char* format, __builtin_va_list args);
 
 #endif /* VGA_H */
\ No newline at end of file
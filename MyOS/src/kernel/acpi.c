@@ -0,0 +1,109 @@
+#include "acpi.h"
+#include "memory.h"
+#include "kernel.h"
+#include "vga.h"
+
+#define BIOS_EBDA_SEGMENT   0x40E   /* Real mode segment of the EBDA */
+#define BIOS_ROM_START      0xE0000
+#define BIOS_ROM_END        0x100000
+
+static int acpi_checksum(const void* data, uint32_t length) {
+    const uint8_t* bytes = data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) sum += bytes[i];
+    return sum == 0;
+}
+
+/* The RSDP sits on a 16 byte boundary in the first KB of the EBDA or in
+ * the BIOS ROM area */
+static acpi_rsdp_t* acpi_scan_rsdp(uint32_t start, uint32_t end) {
+    for (uint32_t addr = start; addr + sizeof(acpi_rsdp_t) <= end; addr += 16) {
+        acpi_rsdp_t* rsdp = PHYS_TO_VIRT(addr);
+        if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0 &&
+            acpi_checksum(rsdp, sizeof(acpi_rsdp_t))) {
+            return rsdp;
+        }
+    }
+    return NULL;
+}
+
+static acpi_rsdp_t* acpi_find_rsdp(void) {
+    uint32_t ebda = *(uint16_t*)PHYS_TO_VIRT(BIOS_EBDA_SEGMENT) << 4;
+    acpi_rsdp_t* rsdp = NULL;
+    if (ebda) rsdp = acpi_scan_rsdp(ebda, ebda + 1024);
+    if (!rsdp) rsdp = acpi_scan_rsdp(BIOS_ROM_START, BIOS_ROM_END);
+    return rsdp;
+}
+
+/* Tables normally live in low memory and are read through the direct map;
+ * anything above it gets a temporary mapping */
+static acpi_header_t* acpi_map_table(uint32_t phys) {
+    if (phys < KERNEL_DIRECT_MAP_SIZE - PAGE_SIZE) {
+        acpi_header_t* header = PHYS_TO_VIRT(phys);
+        if (phys + header->length <= KERNEL_DIRECT_MAP_SIZE) return header;
+    }
+    
+    acpi_header_t* header = ioremap(phys, sizeof(acpi_header_t));
+    if (!header) return NULL;
+    uint32_t length = header->length;
+    iounmap(header);
+    return ioremap(phys, length);
+}
+
+static void acpi_unmap_table(acpi_header_t* header) {
+    if ((uint32_t)header >= VMALLOC_START) iounmap(header);
+}
+
+static void acpi_parse_madt(acpi_madt_t* madt, acpi_smp_info_t* info) {
+    info->lapic_address = madt->lapic_address;
+    
+    uint8_t* entry = (uint8_t*)(madt + 1);
+    uint8_t* end = (uint8_t*)madt + madt->header.length;
+    while (entry + sizeof(madt_entry_t) <= end) {
+        madt_entry_t* header = (madt_entry_t*)entry;
+        if (header->length < sizeof(madt_entry_t)) break;
+        
+        if (header->type == MADT_LOCAL_APIC) {
+            madt_local_apic_t* lapic = (madt_local_apic_t*)entry;
+            if ((lapic->flags & MADT_LAPIC_ENABLED) && info->cpu_count < ACPI_MAX_CPUS) {
+                info->apic_ids[info->cpu_count++] = lapic->apic_id;
+            }
+        } else if (header->type == MADT_LAPIC_ADDRESS_OVERRIDE) {
+            madt_lapic_override_t* override = (madt_lapic_override_t*)entry;
+            if (!(override->address >> 32)) {
+                info->lapic_address = (uint32_t)override->address;
+            }
+        }
+        entry += header->length;
+    }
+}
+
+/* Walk RSDP -> RSDT -> MADT and collect the enabled local APICs.
+ * Returns 0 when there is no usable MADT. */
+int acpi_find_cpus(acpi_smp_info_t* info) {
+    memset(info, 0, sizeof(*info));
+    
+    acpi_rsdp_t* rsdp = acpi_find_rsdp();
+    if (!rsdp) return 0;
+    
+    acpi_header_t* rsdt = acpi_map_table(rsdp->rsdt_address);
+    if (!rsdt) return 0;
+    if (memcmp(rsdt->signature, "RSDT", 4) != 0 || !acpi_checksum(rsdt, rsdt->length)) {
+        acpi_unmap_table(rsdt);
+        return 0;
+    }
+    
+    uint32_t* tables = (uint32_t*)(rsdt + 1);
+    uint32_t count = (rsdt->length - sizeof(acpi_header_t)) / sizeof(uint32_t);
+    for (uint32_t i = 0; i < count && !info->cpu_count; i++) {
+        acpi_header_t* table = acpi_map_table(tables[i]);
+        if (!table) continue;
+        if (memcmp(table->signature, "APIC", 4) == 0 && acpi_checksum(table, table->length)) {
+            acpi_parse_madt((acpi_madt_t*)table, info);
+        }
+        acpi_unmap_table(table);
+    }
+    
+    acpi_unmap_table(rsdt);
+    return info->cpu_count != 0;
+}
\ No newline at end of file
@@ -0,0 +1,88 @@
+#include "apic.h"
+#include "memory.h"
+#include "kernel.h"
+#include "timer.h"
+#include "process.h"
+#include "smp.h"
+#include "cpu.h"
+
+static volatile uint32_t* lapic = NULL;
+static uint32_t lapic_timer_count = 0;     /* Initial count for one scheduler tick */
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    lapic[reg / 4] = value;
+}
+
+/* Every CPU sees its own local APIC at the same physical address, so one
+ * uncached mapping serves them all */
+int apic_init(uint32_t phys) {
+    lapic = ioremap(phys, PAGE_SIZE);
+    return lapic != NULL;
+}
+
+/* Software enable with the spurious vector and accept every priority. The
+ * BSP keeps the virtual wire mode the BIOS set up on LINT0 for the PIC; the
+ * APs mask both local interrupt pins. */
+void apic_init_cpu(void) {
+    lapic_write(LAPIC_TPR, 0);
+    if (this_cpu()->id != 0) {
+        lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+        lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_MASKED);
+    }
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | SPURIOUS_VECTOR);
+}
+
+uint32_t apic_id(void) {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void apic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+void apic_send_ipi(uint32_t dest, uint32_t command) {
+    lapic_write(LAPIC_ICR_HIGH, dest << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_DELIVERY_STATUS) {
+        cpu_relax();
+    }
+}
+
+/* Count the APIC timer across 10ms of TSC time. The bus clock is the same
+ * on every CPU, so the BSP measures once for all of them. */
+void apic_timer_calibrate(void) {
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+    timer_udelay(10000);
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+    
+    lapic_timer_count = elapsed / (TIMER_FREQUENCY / 100);
+}
+
+/* Periodic scheduler tick for an AP; the BSP keeps the PIT */
+void apic_timer_start(void) {
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INITIAL, lapic_timer_count ? lapic_timer_count : 0x10000);
+}
+
+/* A single interrupt ticks scheduler ticks from now, as far as the 32-bit
+ * count reaches. Loading the initial count restarts the timer. */
+void apic_timer_oneshot(uint32_t ticks) {
+    uint32_t count = lapic_timer_count ? lapic_timer_count : 0x10000;
+    if (ticks > 0xFFFFFFFF / count) ticks = 0xFFFFFFFF / count;
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INITIAL, ticks * count);
+}
+
+/* A one-shot only ends an idle halt, timer_idle_exit() accounts for it */
+void apic_timer_handler(void) {
+    if (this_cpu()->timer_oneshot) return;
+    scheduler_tick(1);
+}
\ No newline at end of file
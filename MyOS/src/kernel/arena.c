@@ -0,0 +1,83 @@
+#include "arena.h"
+#include "memory.h"
+#include "kernel.h"
+
+#define ARENA_CHUNK_HEADER  ((sizeof(arena_chunk_t) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+#define ARENA_HEADER        ((sizeof(arena_t) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+static inline uint32_t arena_order_size(uint32_t order) {
+    return (uint32_t)PAGE_SIZE << order;
+}
+
+static arena_chunk_t* arena_chunk_alloc(uint32_t order) {
+    uint32_t phys = alloc_pages(order);
+    if (!phys) return NULL;
+    
+    arena_chunk_t* chunk = PHYS_TO_VIRT(phys);
+    chunk->next = NULL;
+    chunk->order = order;
+    return chunk;
+}
+
+/* The arena header lives in its own first chunk, so creating one costs a
+ * single page and nothing from the kernel heap */
+arena_t* arena_create(void) {
+    arena_chunk_t* chunk = arena_chunk_alloc(0);
+    if (!chunk) return NULL;
+    
+    arena_t* arena = (arena_t*)((uint8_t*)chunk + ARENA_CHUNK_HEADER);
+    arena->first = chunk;
+    arena->current = chunk;
+    arena->offset = ARENA_CHUNK_HEADER + ARENA_HEADER;
+    arena->chunks = 1;
+    arena->allocated = 0;
+    return arena;
+}
+
+void* arena_alloc(arena_t* arena, uint32_t size) {
+    if (size > arena_order_size(BUDDY_MAX_ORDER)) return NULL;
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    
+    while (arena->offset + size > arena_order_size(arena->current->order)) {
+        /* Chunks kept from before a reset are reused in order */
+        arena_chunk_t* next = arena->current->next;
+        if (!next || ARENA_CHUNK_HEADER + size > arena_order_size(next->order)) {
+            uint32_t order = 0;
+            while (order < BUDDY_MAX_ORDER && ARENA_CHUNK_HEADER + size > arena_order_size(order)) {
+                order++;
+            }
+            if (ARENA_CHUNK_HEADER + size > arena_order_size(order)) return NULL;
+            
+            arena_chunk_t* chunk = arena_chunk_alloc(order);
+            if (!chunk) return NULL;
+            chunk->next = next;
+            arena->current->next = chunk;
+            arena->chunks++;
+            next = chunk;
+        }
+        arena->current = next;
+        arena->offset = ARENA_CHUNK_HEADER;
+    }
+    
+    void* ptr = (uint8_t*)arena->current + arena->offset;
+    arena->offset += size;
+    arena->allocated += size;
+    return ptr;
+}
+
+/* Everything allocated so far is gone. Chunks stay with the arena, so this
+ * is constant time and the next round does not go back to the allocator. */
+void arena_reset(arena_t* arena) {
+    arena->current = arena->first;
+    arena->offset = ARENA_CHUNK_HEADER + ARENA_HEADER;
+    arena->allocated = 0;
+}
+
+void arena_destroy(arena_t* arena) {
+    arena_chunk_t* chunk = arena->first;
+    while (chunk) {
+        arena_chunk_t* next = chunk->next;
+        free_pages(VIRT_TO_PHYS(chunk), chunk->order);
+        chunk = next;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,134 @@
+#include "memory.h"
+#include "kernel.h"
+#include "vga.h"
+
+/* Free list for one block order */
+typedef struct free_area {
+    page_t* head;
+    uint32_t count;
+} free_area_t;
+
+static free_area_t free_areas[BUDDY_MAX_ORDER + 1];
+static uint32_t free_area_map = 0;  /* Bit set for each non-empty order */
+static uint32_t buddy_free_count = 0;
+
+static void buddy_list_add(uint32_t order, page_t* page) {
+    free_area_t* area = &free_areas[order];
+    page->flags |= PAGE_FLAG_BUDDY;
+    page->order = order;
+    page->prev = NULL;
+    page->next = area->head;
+    if (area->head) area->head->prev = page;
+    area->head = page;
+    area->count++;
+    free_area_map |= 1 << order;
+}
+
+static void buddy_list_remove(uint32_t order, page_t* page) {
+    free_area_t* area = &free_areas[order];
+    if (page->prev) page->prev->next = page->next;
+    else area->head = page->next;
+    if (page->next) page->next->prev = page->prev;
+    area->count--;
+    if (!area->head) free_area_map &= ~(1 << order);
+    page->flags &= ~PAGE_FLAG_BUDDY;
+    page->next = NULL;
+    page->prev = NULL;
+}
+
+uint32_t buddy_metadata_size(uint32_t total_pages) {
+    (void)total_pages; /* Free lists live in mem_map */
+    return 0;
+}
+
+void buddy_init(uint32_t total_pages, uint32_t metadata) {
+    (void)total_pages; (void)metadata;
+    
+    for (uint32_t i = 0; i <= BUDDY_MAX_ORDER; i++) {
+        free_areas[i].head = NULL;
+        free_areas[i].count = 0;
+    }
+    free_area_map = 0;
+    buddy_free_count = 0;
+}
+
+void buddy_add_range(uint32_t start, uint32_t end) {
+    uint32_t pfn = (start + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t end_pfn = end / PAGE_SIZE;
+    
+    /* Hand the range over as the largest naturally aligned blocks that fit */
+    while (pfn < end_pfn) {
+        uint32_t order = BUDDY_MAX_ORDER;
+        while (order > 0 && ((pfn & ((1 << order) - 1)) || pfn + (1 << order) > end_pfn)) {
+            order--;
+        }
+        buddy_free(pfn * PAGE_SIZE, order);
+        pfn += 1 << order;
+    }
+}
+
+uint32_t buddy_alloc(uint32_t order) {
+    if (order > BUDDY_MAX_ORDER) return 0;
+    
+    /* Smallest non-empty order that can satisfy the request */
+    uint32_t candidates = free_area_map & ~((1 << order) - 1);
+    if (!candidates) return 0; /* Out of physical memory */
+    
+    uint32_t current = __builtin_ctz(candidates);
+    page_t* page = free_areas[current].head;
+    buddy_list_remove(current, page);
+    
+    /* Split down, returning the upper halves to the free lists */
+    while (current > order) {
+        current--;
+        buddy_list_add(current, page + (1 << current));
+    }
+    
+    page->order = order;
+    buddy_free_count -= 1 << order;
+    return page_to_phys(page);
+}
+
+void buddy_free(uint32_t addr, uint32_t order) {
+    page_t* page = phys_to_page(addr);
+    if (!page || order > BUDDY_MAX_ORDER) return;
+    
+    uint32_t pfn = addr / PAGE_SIZE;
+    buddy_free_count += 1 << order;
+    
+    /* Coalesce with the buddy as long as it is free and of the same order */
+    while (order < BUDDY_MAX_ORDER) {
+        page_t* buddy = phys_to_page((pfn ^ (1 << order)) * PAGE_SIZE);
+        if (!buddy || !(buddy->flags & PAGE_FLAG_BUDDY) || buddy->order != order) {
+            break;
+        }
+        buddy_list_remove(order, buddy);
+        pfn &= ~(1 << order);
+        order++;
+    }
+    
+    buddy_list_add(order, phys_to_page(pfn * PAGE_SIZE));
+}
+
+uint32_t buddy_free_pages(void) {
+    return buddy_free_count;
+}
+
+void buddy_info(void) {
+    vga_puts("\nFree blocks per order:\n");
+    for (uint32_t i = 0; i <= BUDDY_MAX_ORDER; i++) {
+        vga_printf("%d:%d ", i, free_areas[i].count);
+    }
+    vga_putchar('\n');
+}
+
+const frame_allocator_t buddy_frame_allocator = {
+    "buddy",
+    buddy_metadata_size,
+    buddy_init,
+    buddy_add_range,
+    buddy_alloc,
+    buddy_free,
+    buddy_free_pages,
+    buddy_info
+};
\ No newline at end of file
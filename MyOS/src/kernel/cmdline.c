@@ -0,0 +1,58 @@
+#include "cmdline.h"
+#include "kernel.h"
+
+/* Parsed "key=value" or bare "key" options from the boot command line */
+typedef struct {
+    const char* key;
+    const char* value;
+} cmdline_option_t;
+
+static char cmdline_buffer[CMDLINE_MAX_LENGTH];
+static cmdline_option_t cmdline_options[CMDLINE_MAX_OPTIONS];
+static int cmdline_option_count = 0;
+
+void cmdline_init(const char* cmdline) {
+    cmdline_option_count = 0;
+    if (!cmdline) return;
+    
+    /* Keep a private copy, the boot loader's buffer is not ours to keep */
+    strncpy(cmdline_buffer, cmdline, CMDLINE_MAX_LENGTH - 1);
+    cmdline_buffer[CMDLINE_MAX_LENGTH - 1] = '\0';
+    
+    char* token = cmdline_buffer;
+    while (*token && cmdline_option_count < CMDLINE_MAX_OPTIONS) {
+        /* Skip leading spaces */
+        while (*token == ' ') token++;
+        if (!*token) break;
+        
+        cmdline_option_t* option = &cmdline_options[cmdline_option_count++];
+        option->key = token;
+        option->value = NULL;
+        
+        /* Find end of token, splitting off the value at '=' */
+        while (*token && *token != ' ') {
+            if (*token == '=' && !option->value) {
+                *token = '\0';
+                option->value = token + 1;
+            }
+            token++;
+        }
+        if (*token) {
+            *token = '\0';
+            token++;
+        }
+    }
+}
+
+const char* cmdline_get(const char* key) {
+    for (int i = 0; i < cmdline_option_count; i++) {
+        if (strcmp(cmdline_options[i].key, key) == 0) {
+            return cmdline_options[i].value ? cmdline_options[i].value : "";
+        }
+    }
+    return NULL;
+}
+
+int cmdline_has(const char* key) {
+    return cmdline_get(key) != NULL;
+}
\ No newline at end of file
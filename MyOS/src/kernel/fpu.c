@@ -0,0 +1,182 @@
+#include "fpu.h"
+#include "interrupts.h"
+#include "memory.h"
+#include "kernel.h"
+#include "vga.h"
+#include "cpu.h"
+#include "smp.h"
+
+#define CR0_MP  0x00000002      /* WAIT/FWAIT honour TS */
+#define CR0_EM  0x00000004      /* Emulate the FPU */
+#define CR0_TS  0x00000008      /* Task switched, next FPU use traps */
+#define CR0_NE  0x00000020      /* Native FPU error reporting */
+#define CR4_OSFXSR      0x00000200
+#define CR4_OSXMMEXCPT  0x00000400
+
+#define CPUID_EDX_FPU   0x00000001
+#define CPUID_EDX_FXSR  0x01000000
+#define CPUID_EDX_SSE   0x02000000
+
+#define MXCSR_DEFAULT   0x1F80  /* All SIMD exceptions masked */
+
+/* The task whose state is in a CPU's registers is this_cpu()->fpu_owner */
+static int fpu_present = 0;
+static int fpu_fxsr = 0;                /* FXSAVE available, else FNSAVE */
+static int fpu_sse = 0;
+static uint32_t fpu_traps = 0;
+static uint32_t fpu_saves = 0;
+static uint32_t fpu_restores = 0;
+static uint32_t fpu_users = 0;          /* Save areas allocated */
+
+static inline uint32_t read_cr0(void) {
+    uint32_t value;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr0(uint32_t value) {
+    __asm__ volatile ("mov %0, %%cr0" : : "r"(value));
+}
+
+static inline void fpu_clts(void) {
+    __asm__ volatile ("clts");
+}
+
+static inline void fpu_stts(void) {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+static void fpu_save(void* state) {
+    if (fpu_fxsr) __asm__ volatile ("fxsave (%0)" : : "r"(state) : "memory");
+    else __asm__ volatile ("fnsave (%0); fwait" : : "r"(state) : "memory");
+    fpu_saves++;
+}
+
+static void fpu_restore(void* state) {
+    if (fpu_fxsr) __asm__ volatile ("fxrstor (%0)" : : "r"(state) : "memory");
+    else __asm__ volatile ("frstor (%0)" : : "r"(state) : "memory");
+    fpu_restores++;
+}
+
+/* The FPU is only touched after clts, so the registers always belong to
+ * the CPU's fpu_owner and are saved lazily when somebody else wants them */
+static void fpu_trap_handler(registers_t* regs) {
+    cpu_t* cpu = this_cpu();
+    process_t* proc = cpu->current;
+    if (!proc) kernel_panic("FPU used before the scheduler started");
+    
+    fpu_clts();
+    fpu_traps++;
+    if (cpu->fpu_owner == proc) return;
+    
+    if (cpu->fpu_owner) fpu_save(cpu->fpu_owner->fpu_state);
+    
+    if (!proc->fpu_state) {
+        /* Slab objects are naturally aligned, FXSAVE needs 16 bytes */
+        proc->fpu_state = slab_alloc(FPU_STATE_SIZE);
+        if (!proc->fpu_state) {
+            vga_printf("No memory for FPU state of PID %d at EIP 0x%x\n",
+                       proc->pid, regs->eip);
+            kernel_panic("FPU state allocation failed");
+        }
+        fpu_users++;
+        
+        __asm__ volatile ("fninit");
+        if (fpu_sse) {
+            uint32_t mxcsr = MXCSR_DEFAULT;
+            __asm__ volatile ("ldmxcsr %0" : : "m"(mxcsr));
+        }
+    } else {
+        fpu_restore(proc->fpu_state);
+    }
+    
+    cpu->fpu_owner = proc;
+}
+
+void fpu_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    __asm__ volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    
+    if (!(edx & CPUID_EDX_FPU)) {
+        vga_puts("No FPU present, floating point disabled\n");
+        return;
+    }
+    fpu_present = 1;
+    fpu_fxsr = (edx & CPUID_EDX_FXSR) != 0;
+    fpu_sse = fpu_fxsr && (edx & CPUID_EDX_SSE);
+    
+    exception_install_handler(7, fpu_trap_handler);
+    fpu_init_cpu();
+    
+    vga_printf("FPU initialized (%s, lazy switching)\n",
+               fpu_sse ? "SSE" : fpu_fxsr ? "FXSR" : "x87");
+}
+
+/* Control register setup, on the BSP from fpu_init() and on every AP */
+void fpu_init_cpu(void) {
+    if (!fpu_present) return;
+    
+    if (fpu_fxsr) {
+        uint32_t cr4;
+        __asm__ volatile ("mov %%cr4, %0" : "=r"(cr4));
+        cr4 |= CR4_OSFXSR;
+        if (fpu_sse) cr4 |= CR4_OSXMMEXCPT;
+        __asm__ volatile ("mov %0, %%cr4" : : "r"(cr4));
+    }
+    
+    write_cr0((read_cr0() & ~CR0_EM) | CR0_MP | CR0_NE);
+    fpu_stts();
+}
+
+/* Called on every context switch: only the owner may use the registers
+ * without trapping first. A task that may migrate cannot leave its state
+ * behind in this CPU's registers, so with other CPUs up it is saved now;
+ * loading stays lazy. */
+void fpu_switch(process_t* prev, process_t* next) {
+    cpu_t* cpu = this_cpu();
+    if (smp_active && cpu->fpu_owner == prev && !(prev->flags & PROCESS_PINNED)) {
+        fpu_clts();
+        fpu_save(prev->fpu_state);
+        cpu->fpu_owner = NULL;
+    }
+    
+    if (next == cpu->fpu_owner) fpu_clts();
+    else fpu_stts();
+}
+
+/* The child inherits the parent's FPU state, live or saved */
+void fpu_fork(process_t* parent, process_t* child) {
+    child->fpu_state = NULL;
+    if (!parent->fpu_state) return;
+    
+    child->fpu_state = slab_alloc(FPU_STATE_SIZE);
+    if (!child->fpu_state) return; /* Starts from a clean FPU instead */
+    fpu_users++;
+    
+    uint32_t flags = irq_save();
+    if (this_cpu()->fpu_owner == parent) {
+        /* FXSAVE leaves the registers intact, FNSAVE reinitialises them */
+        fpu_clts();
+        fpu_save(child->fpu_state);
+        if (!fpu_fxsr) fpu_restore(child->fpu_state);
+    } else {
+        memcpy(child->fpu_state, parent->fpu_state, FPU_STATE_SIZE);
+    }
+    irq_restore(flags);
+}
+
+void fpu_release(process_t* proc) {
+    for (uint32_t i = 0; i < smp_cpu_count; i++) {
+        if (cpus[i].fpu_owner == proc) cpus[i].fpu_owner = NULL;
+    }
+    if (proc->fpu_state) {
+        slab_free(proc->fpu_state);
+        proc->fpu_state = NULL;
+        fpu_users--;
+    }
+}
+
+void fpu_info(void) {
+    vga_printf("\nFPU: %u tasks with state, %u traps, %u saves, %u restores\n",
+               fpu_users, fpu_traps, fpu_saves, fpu_restores);
+}
\ No newline at end of file
@@ -0,0 +1,155 @@
+#include "memory.h"
+#include "kernel.h"
+#include "vga.h"
+
+/*
+ * Two-level frame bitmap. Level 0 has one bit per frame (set = in use).
+ * Level 1 has one bit per level 0 word, set when that word is completely
+ * used, so a free frame is found with two ctz lookups per summary word.
+ */
+static uint32_t* frame_bitmap = NULL;
+static uint32_t* frame_summary = NULL;
+static uint32_t bitmap_pages = 0;
+static uint32_t bitmap_words = 0;
+static uint32_t summary_words = 0;
+static uint32_t bitmap_free_count = 0;
+static uint32_t bitmap_hint = 0;    /* Summary word of the last allocation */
+
+static inline void bitmap_update_summary(uint32_t word) {
+    if (frame_bitmap[word] == 0xFFFFFFFF) {
+        frame_summary[word / 32] |= 1 << (word % 32);
+    } else {
+        frame_summary[word / 32] &= ~(1 << (word % 32));
+    }
+}
+
+static void bitmap_mark(uint32_t pfn, uint32_t count, int used) {
+    while (count > 0) {
+        uint32_t word = pfn / 32;
+        uint32_t bit = pfn % 32;
+        uint32_t span = 32 - bit;
+        if (span > count) span = count;
+        uint32_t mask = (span == 32) ? 0xFFFFFFFF : ((1u << span) - 1) << bit;
+        
+        if (used) frame_bitmap[word] |= mask;
+        else frame_bitmap[word] &= ~mask;
+        bitmap_update_summary(word);
+        
+        pfn += span;
+        count -= span;
+    }
+}
+
+static uint32_t bitmap_metadata_size(uint32_t total_pages) {
+    uint32_t words = (total_pages + 31) / 32;
+    return (words + (words + 31) / 32) * sizeof(uint32_t);
+}
+
+static void bitmap_init(uint32_t total_pages, uint32_t metadata) {
+    bitmap_pages = total_pages;
+    bitmap_words = (total_pages + 31) / 32;
+    summary_words = (bitmap_words + 31) / 32;
+    frame_bitmap = (uint32_t*)metadata;
+    frame_summary = frame_bitmap + bitmap_words;
+    bitmap_free_count = 0;
+    bitmap_hint = 0;
+    
+    /* Everything starts out used, including the padding past the last frame */
+    memset(frame_bitmap, 0xFF, bitmap_words * sizeof(uint32_t));
+    memset(frame_summary, 0xFF, summary_words * sizeof(uint32_t));
+}
+
+static void bitmap_add_range(uint32_t start, uint32_t end) {
+    uint32_t pfn = (start + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t end_pfn = end / PAGE_SIZE;
+    if (end_pfn > bitmap_pages) end_pfn = bitmap_pages;
+    if (pfn >= end_pfn) return;
+    
+    bitmap_mark(pfn, end_pfn - pfn, 0);
+    bitmap_free_count += end_pfn - pfn;
+}
+
+/* Find an aligned run of 2^order free frames inside a single bitmap word */
+static int bitmap_find_in_word(uint32_t word, uint32_t order) {
+    uint32_t count = 1 << order;
+    uint32_t value = frame_bitmap[word];
+    
+    if (order == 0) return __builtin_ctz(~value);
+    
+    uint32_t mask = (count == 32) ? 0xFFFFFFFF : (1u << count) - 1;
+    for (uint32_t bit = 0; bit < 32; bit += count) {
+        if (!(value & (mask << bit))) return bit;
+    }
+    return -1;
+}
+
+static uint32_t bitmap_alloc(uint32_t order) {
+    uint32_t count = 1 << order;
+    if (order > BUDDY_MAX_ORDER || bitmap_free_count < count) return 0;
+    
+    if (count <= 32) {
+        /* Only visit words the summary reports as not completely used */
+        for (uint32_t i = 0; i < summary_words; i++) {
+            uint32_t s = bitmap_hint + i;
+            if (s >= summary_words) s -= summary_words;
+            
+            uint32_t candidates = ~frame_summary[s];
+            while (candidates) {
+                uint32_t word = s * 32 + __builtin_ctz(candidates);
+                candidates &= candidates - 1;
+                
+                int bit = bitmap_find_in_word(word, order);
+                if (bit < 0) continue;
+                
+                uint32_t pfn = word * 32 + bit;
+                bitmap_mark(pfn, count, 1);
+                bitmap_free_count -= count;
+                bitmap_hint = s;
+                return pfn * PAGE_SIZE;
+            }
+        }
+        return 0;
+    }
+    
+    /* Runs longer than a word need consecutive empty words, scanned linearly */
+    uint32_t words_needed = count / 32;
+    for (uint32_t word = 0; word + words_needed <= bitmap_words; word += words_needed) {
+        uint32_t i = 0;
+        while (i < words_needed && frame_bitmap[word + i] == 0) i++;
+        if (i == words_needed) {
+            bitmap_mark(word * 32, count, 1);
+            bitmap_free_count -= count;
+            return word * 32 * PAGE_SIZE;
+        }
+    }
+    return 0;
+}
+
+static void bitmap_free(uint32_t addr, uint32_t order) {
+    uint32_t pfn = addr / PAGE_SIZE;
+    uint32_t count = 1 << order;
+    if (order > BUDDY_MAX_ORDER || pfn + count > bitmap_pages) return;
+    
+    bitmap_mark(pfn, count, 0);
+    bitmap_free_count += count;
+}
+
+static uint32_t bitmap_free_pages(void) {
+    return bitmap_free_count;
+}
+
+static void bitmap_info(void) {
+    vga_printf("\nFrame bitmap: %d words, %d summary words, hint %d\n",
+               bitmap_words, summary_words, bitmap_hint);
+}
+
+const frame_allocator_t bitmap_frame_allocator = {
+    "bitmap",
+    bitmap_metadata_size,
+    bitmap_init,
+    bitmap_add_range,
+    bitmap_alloc,
+    bitmap_free,
+    bitmap_free_pages,
+    bitmap_info
+};
\ No newline at end of file
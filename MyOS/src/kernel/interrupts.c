@@ -3,11 +3,16 @@
 #include "vga.h"
 #include "timer.h"
 #include "keyboard.h"
+#include "softirq.h"
+#include "apic.h"
+#include "smp.h"
+#include "process.h"
 
 /* IDT and interrupt handlers */
 static struct idt_entry idt[IDT_SIZE];
 static struct idt_ptr idt_pointer;
 static interrupt_handler_t interrupt_handlers[IDT_SIZE];
+static exception_handler_t exception_handlers[32];
 
 /* PIC constants */
 #define PIC1_COMMAND 0x20
@@ -59,6 +64,7 @@ void idt_init(void) {
     /* Clear IDT and handlers */
     memset(&idt, 0, sizeof(idt));
     memset(&interrupt_handlers, 0, sizeof(interrupt_handlers));
+    memset(&exception_handlers, 0, sizeof(exception_handlers));
     
     /* Remap PIC */
     outb(PIC1_COMMAND, 0x11);
@@ -124,7 +130,16 @@ void idt_init(void) {
     idt_set_gate(46, (uint32_t)irq14, KERNEL_CODE_SEGMENT, 0x8E);
     idt_set_gate(47, (uint32_t)irq15, KERNEL_CODE_SEGMENT, 0x8E);
     
-    /* Load IDT */
+    /* Local APIC */
+    idt_set_gate(LAPIC_TIMER_VECTOR, (uint32_t)irq16, KERNEL_CODE_SEGMENT, 0x8E);
+    idt_set_gate(IPI_VECTOR, (uint32_t)irq17, KERNEL_CODE_SEGMENT, 0x8E);
+    idt_set_gate(SPURIOUS_VECTOR, (uint32_t)irq_spurious, KERNEL_CODE_SEGMENT, 0x8E);
+    
+    idt_load();
+}
+
+/* The table is shared, every CPU loads it once */
+void idt_load(void) {
     __asm__ volatile ("lidt %0" : : "m"(idt_pointer));
 }
 
@@ -140,21 +155,48 @@ void interrupt_install_handler(uint8_t interrupt, interrupt_handler_t handler) {
     interrupt_handlers[interrupt] = handler;
 }
 
+void exception_install_handler(uint8_t exception, exception_handler_t handler) {
+    if (exception < 32) {
+        exception_handlers[exception] = handler;
+    }
+}
+
 /* ISR handler */
-void isr_handler(uint32_t interrupt_number, uint32_t error_code) {
-    if (interrupt_handlers[interrupt_number]) {
+void isr_handler(registers_t* regs) {
+    uint32_t interrupt_number = regs->int_no;
+    
+    if (interrupt_number < 32 && exception_handlers[interrupt_number]) {
+        exception_handlers[interrupt_number](regs);
+    } else if (interrupt_handlers[interrupt_number]) {
         interrupt_handlers[interrupt_number]();
     } else {
         vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_RED);
-        vga_printf("Unhandled exception: %s (Error: 0x%x)\n", 
-                   exception_messages[interrupt_number], error_code);
+        vga_printf("Unhandled exception: %s (Error: 0x%x, EIP: 0x%x)\n", 
+                   exception_messages[interrupt_number], regs->err_code, regs->eip);
+        
+        /* A user task only takes itself down */
+        if ((regs->cs & 3) == 3) {
+            vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+            process_exit(EXIT_FAULT + interrupt_number);
+        }
         kernel_panic("Unhandled CPU exception");
     }
 }
 
 /* IRQ handler */
-void irq_handler(uint32_t irq_number, uint32_t error_code) {
-    (void)error_code; /* Unused parameter */
+void irq_handler(registers_t* regs) {
+    uint32_t irq_number = regs->int_no;
+    
+    /* Acknowledge first: the timer may switch to a task that does not come
+     * back through here for a while */
+    if (irq_number >= LAPIC_VECTOR_BASE) {
+        apic_eoi();
+    } else {
+        if (irq_number >= 40) {
+            outb(PIC2_COMMAND, 0x20);
+        }
+        outb(PIC1_COMMAND, 0x20);
+    }
     
     /* Handle specific IRQs */
     switch (irq_number) {
@@ -164,6 +206,12 @@ void irq_handler(uint32_t irq_number, uint32_t error_code) {
         case 33: /* Keyboard IRQ1 */
             keyboard_handler();
             break;
+        case LAPIC_TIMER_VECTOR:
+            apic_timer_handler();
+            break;
+        case IPI_VECTOR:
+            smp_ipi_handler();
+            break;
         default:
             if (interrupt_handlers[irq_number]) {
                 interrupt_handlers[irq_number]();
@@ -171,9 +219,6 @@ void irq_handler(uint32_t irq_number, uint32_t error_code) {
             break;
     }
     
-    /* Send EOI to PIC */
-    if (irq_number >= 40) {
-        outb(PIC2_COMMAND, 0x20);
-    }
-    outb(PIC1_COMMAND, 0x20);
+    /* Bottom halves and preemption, with interrupts enabled again */
+    irq_exit();
 }
\ No newline at end of file
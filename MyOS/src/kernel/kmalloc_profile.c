@@ -0,0 +1,153 @@
+#include "memory.h"
+#include "kernel.h"
+#include "vga.h"
+#include "timer.h"
+
+#ifdef CONFIG_KMALLOC_PROFILE
+
+/*
+ * Allocation profiler, built with KMALLOC_PROFILE=1. Every live allocation
+ * has a record keyed by its address, and every kmalloc caller has a site
+ * entry with running totals. Both are open addressing tables in static
+ * storage so the profiler never allocates itself.
+ */
+#define PROFILE_RECORD_BITS 12
+#define PROFILE_RECORDS     (1 << PROFILE_RECORD_BITS)
+#define PROFILE_SITE_BITS   8
+#define PROFILE_SITES       (1 << PROFILE_SITE_BITS)
+#define PROFILE_TOP_SITES   8
+#define PROFILE_MAX_OLD     16
+
+typedef struct profile_site {
+    uint32_t caller;
+    uint32_t live_bytes;
+    uint32_t live_count;
+    uint32_t total_count;
+    uint32_t first_tick;
+} profile_site_t;
+
+typedef struct profile_record {
+    uint32_t ptr;           /* 0 marks an empty slot */
+    uint32_t size;
+    uint32_t tick;
+    uint16_t site;
+} profile_record_t;
+
+static profile_site_t profile_sites[PROFILE_SITES];
+static profile_record_t profile_records[PROFILE_RECORDS];
+static uint32_t profile_dropped = 0;    /* Allocations that found no free slot */
+
+static inline uint32_t profile_hash(uint32_t key, uint32_t bits) {
+    return ((key >> 2) * 2654435761u) >> (32 - bits);
+}
+
+static profile_site_t* profile_site_get(uint32_t caller) {
+    uint32_t index = profile_hash(caller, PROFILE_SITE_BITS);
+    for (uint32_t i = 0; i < PROFILE_SITES; i++) {
+        profile_site_t* site = &profile_sites[index];
+        if (site->caller == caller) return site;
+        if (site->caller == 0) {
+            site->caller = caller;
+            site->first_tick = timer_get_ticks();
+            return site;
+        }
+        index = (index + 1) & (PROFILE_SITES - 1);
+    }
+    return NULL;
+}
+
+void kmalloc_profile_alloc(void* ptr, uint32_t size, void* caller) {
+    profile_site_t* site = profile_site_get((uint32_t)caller);
+    if (!site) {
+        profile_dropped++;
+        return;
+    }
+    
+    uint32_t index = profile_hash((uint32_t)ptr, PROFILE_RECORD_BITS);
+    for (uint32_t i = 0; i < PROFILE_RECORDS; i++) {
+        profile_record_t* record = &profile_records[index];
+        if (record->ptr == 0) {
+            record->ptr = (uint32_t)ptr;
+            record->size = size;
+            record->tick = timer_get_ticks();
+            record->site = site - profile_sites;
+            site->live_bytes += size;
+            site->live_count++;
+            site->total_count++;
+            return;
+        }
+        index = (index + 1) & (PROFILE_RECORDS - 1);
+    }
+    profile_dropped++;
+}
+
+void kmalloc_profile_free(void* ptr) {
+    uint32_t index = profile_hash((uint32_t)ptr, PROFILE_RECORD_BITS);
+    while (profile_records[index].ptr != (uint32_t)ptr) {
+        if (profile_records[index].ptr == 0) return; /* Not tracked */
+        index = (index + 1) & (PROFILE_RECORDS - 1);
+    }
+    
+    profile_site_t* site = &profile_sites[profile_records[index].site];
+    site->live_bytes -= profile_records[index].size;
+    site->live_count--;
+    
+    /* Backward shift deletion keeps every probe chain unbroken */
+    uint32_t hole = index;
+    uint32_t next = (index + 1) & (PROFILE_RECORDS - 1);
+    while (profile_records[next].ptr != 0) {
+        uint32_t home = profile_hash(profile_records[next].ptr, PROFILE_RECORD_BITS);
+        if (((next - home) & (PROFILE_RECORDS - 1)) >= ((next - hole) & (PROFILE_RECORDS - 1))) {
+            profile_records[hole] = profile_records[next];
+            hole = next;
+        }
+        next = (next + 1) & (PROFILE_RECORDS - 1);
+    }
+    profile_records[hole].ptr = 0;
+}
+
+void kmalloc_profile_report(uint32_t min_age_seconds) {
+    uint32_t now = timer_get_ticks();
+    uint8_t shown[PROFILE_SITES];
+    memset(shown, 0, sizeof(shown));
+    
+    vga_puts("Top allocation sites by live bytes:\n");
+    vga_puts("Caller      Live bytes  Live  Allocs  Allocs/s\n");
+    for (uint32_t n = 0; n < PROFILE_TOP_SITES; n++) {
+        profile_site_t* best = NULL;
+        for (uint32_t i = 0; i < PROFILE_SITES; i++) {
+            profile_site_t* site = &profile_sites[i];
+            if (site->caller == 0 || shown[i]) continue;
+            if (!best || site->live_bytes > best->live_bytes) best = site;
+        }
+        if (!best) break;
+        shown[best - profile_sites] = 1;
+        
+        uint32_t elapsed = (now - best->first_tick) / TIMER_FREQUENCY;
+        vga_printf("0x%-8x  %-10u  %-4u  %-6u  %u\n", best->caller,
+                   best->live_bytes, best->live_count, best->total_count,
+                   elapsed ? best->total_count / elapsed : best->total_count);
+    }
+    
+    vga_printf("\nOutstanding allocations older than %u s:\n", min_age_seconds);
+    uint32_t old = 0;
+    for (uint32_t i = 0; i < PROFILE_RECORDS; i++) {
+        profile_record_t* record = &profile_records[i];
+        if (record->ptr == 0) continue;
+        
+        uint32_t age = (now - record->tick) / TIMER_FREQUENCY;
+        if (age < min_age_seconds) continue;
+        if (old++ < PROFILE_MAX_OLD) {
+            vga_printf("0x%x  %u bytes  from 0x%x  %u s\n", record->ptr, record->size,
+                       profile_sites[record->site].caller, age);
+        }
+    }
+    if (old > PROFILE_MAX_OLD) {
+        vga_printf("... %u more\n", old - PROFILE_MAX_OLD);
+    }
+    if (profile_dropped) {
+        vga_printf("%u allocations were not tracked (tables full)\n", profile_dropped);
+    }
+}
+
+#endif /* CONFIG_KMALLOC_PROFILE */
\ No newline at end of file
@@ -6,33 +6,17 @@
 #include "memory.h"
 #include "shell.h"
 #include "timer.h"
+#include "multiboot.h"
+#include "cmdline.h"
+#include "serial.h"
+#include "tss.h"
+#include "fpu.h"
+#include "softirq.h"
+#include "smp.h"
+#include "syscall.h"
+#include "vdso.h"
 
 
-/* Multiboot information structure */
-struct multiboot_info {
-    uint32_t flags;
-    uint32_t mem_lower;
-    uint32_t mem_upper;
-    uint32_t boot_device;
-    uint32_t cmdline;
-    uint32_t mods_count;
-    uint32_t mods_addr;
-    uint32_t syms[4];
-    uint32_t mmap_length;
-    uint32_t mmap_addr;
-    uint32_t drives_length;
-    uint32_t drives_addr;
-    uint32_t config_table;
-    uint32_t boot_loader_name;
-    uint32_t apm_table;
-    uint32_t vbe_control_info;
-    uint32_t vbe_mode_info;
-    uint16_t vbe_mode;
-    uint16_t vbe_interface_seg;
-    uint16_t vbe_interface_off;
-    uint16_t vbe_interface_len;
-} __attribute__((packed));
-
 static struct multiboot_info* mboot_info;
 
 void kernel_main(uint32_t magic, struct multiboot_info* mboot) {
@@ -47,26 +31,17 @@ void kernel_main(uint32_t magic, struct multiboot_info* mboot) {
     vga_puts("Kernel starting...\n");
     
     /* Also output to serial port for debugging */
-    const char* msg = "MyOS kernel started via serial\n";
-    for (int i = 0; msg[i]; i++) {
-        outb(0x3F8, msg[i]); /* COM1 serial port */
-    }
-    
-    /* Debug function to output to serial */
-    void debug_serial(const char* str) {
-        for (int i = 0; str[i]; i++) {
-            outb(0x3F8, str[i]);
-        }
-    }
+    serial_init();
+    serial_puts("MyOS kernel started via serial\n");
     
-    debug_serial("Starting welcome message\n");
+    serial_puts("Starting welcome message\n");
     
     /* Print welcome message */
     vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
     vga_puts("MyOS v1.0.0 - Custom Operating System\n");
     vga_puts("=====================================\n\n");
     
-    debug_serial("Verifying multiboot\n");
+    serial_puts("Verifying multiboot\n");
     
     /* Verify multiboot magic */
     if (magic != 0x2BADB002) {
@@ -79,48 +54,61 @@ void kernel_main(uint32_t magic, struct multiboot_info* mboot) {
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     vga_puts("Multiboot verification: OK\n");
     
-    debug_serial("Multiboot OK\n");
+    serial_puts("Multiboot OK\n");
     
-    debug_serial("Starting memory init\n");
+    serial_puts("Starting memory init\n");
+    
+    /* Paging keeps the loaded directory in the per-CPU area */
+    smp_early_init();
     
     /* Initialize memory management */
     vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
     vga_puts("Initializing memory management...\n");
-    if (mboot_info->flags & 0x1) {
-        memory_init(mboot_info->mem_lower, mboot_info->mem_upper);
-        // Skip paging for now
-        // paging_init();
+    if (mboot_info->flags & MULTIBOOT_INFO_CMDLINE) {
+        cmdline_init(PHYS_TO_VIRT(mboot_info->cmdline));
     }
+    memory_init(mboot_info);
+    paging_init();
     
-    debug_serial("Starting timer init\n");
+    serial_puts("Starting timer init\n");
     
     /* Initialize timer */
     vga_puts("Initializing timer...\n");
-    // Temporarily disable timer
-    // timer_init();
-    // time_init();
+    timer_init();
+    time_init();
+    vdso_init();
     
-    debug_serial("Starting interrupt init\n");
+    serial_puts("Starting interrupt init\n");
     
     /* Initialize interrupt system */
     vga_puts("Initializing interrupt system...\n");
+    tss_init();
     idt_init();
+    page_fault_init();
+    fpu_init();
+    syscall_init();
     
-    debug_serial("Starting process init\n");
+    serial_puts("Starting process init\n");
     
     /* Initialize process management */
     vga_puts("Initializing process management...\n");
-    // Skip process management for now
-    // process_init();
-    // scheduler_init();
+    process_init();
+    scheduler_init();
+    softirq_init();
     
-    debug_serial("Starting keyboard init\n");
+    serial_puts("Starting keyboard init\n");
     
     /* Initialize keyboard */
     vga_puts("Initializing keyboard...\n");
     keyboard_init();
     
-    debug_serial("Enabling interrupts\n");
+    serial_puts("Starting SMP init\n");
+    
+    /* Bring up the other processors while nothing has been preempted yet */
+    vga_puts("Starting application processors...\n");
+    smp_init();
+    
+    serial_puts("Enabling interrupts\n");
     
     /* Enable interrupts */
     __asm__ volatile ("sti");
@@ -157,64 +145,34 @@ void kernel_main(uint32_t magic, struct multiboot_info* mboot) {
         outb(0x3F8, start_msg[i]); /* COM1 serial port */
     }
     
-    debug_serial("Starting shell init\n");
+    serial_puts("Starting shell init\n");
     
     /* Initialize and run shell */
     vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
     vga_puts("\nStarting shell...\n\n");
     
-    // Temporarily replace shell with simple test
-    vga_puts("MyOS Shell v1.0\n");
-    vga_puts("Type 'help' for available commands\n\n");
-    vga_puts("myos> ");
+    shell_init();
+    shell_run();
     
-    debug_serial("Starting simple shell loop\n");
-    
-    /* Simple shell loop for testing */
-    char input_buffer[256];
-    int buffer_pos = 0;
-    
-    while (1) {
-        if (keyboard_available()) {
-            char c = keyboard_getchar();
-            
-            if (c == '\n') {
-                input_buffer[buffer_pos] = '\0';
-                vga_puts("\n");
-                
-                if (strcmp(input_buffer, "help") == 0) {
-                    vga_puts("Available commands: help, clear, version, reboot\n");
-                } else if (strcmp(input_buffer, "clear") == 0) {
-                    vga_clear();
-                } else if (strcmp(input_buffer, "version") == 0) {
-                    vga_puts("MyOS v1.0.0 - Custom Operating System\n");
-                } else if (strcmp(input_buffer, "reboot") == 0) {
-                    vga_puts("Rebooting...\n");
-                    outb(0x64, 0xFE);
-                } else if (buffer_pos > 0) {
-                    vga_printf("Unknown command: %s\n", input_buffer);
-                }
-                
-                buffer_pos = 0;
-                vga_puts("myos> ");
-            } else if (c == '\b') {
-                if (buffer_pos > 0) {
-                    buffer_pos--;
-                    vga_puts("\b \b");
-                }
-            } else if (c >= 32 && c <= 126 && buffer_pos < 255) {
-                input_buffer[buffer_pos++] = c;
-                vga_putchar(c);
-            }
-        }
-    }
-    
-    debug_serial("Shell exited\n");
+    serial_puts("Shell exited\n");
 }
 
 void idle_process(void) {
     while (1) {
-        __asm__ volatile ("hlt"); /* Halt until next interrupt */
+        /* Spend idle time zeroing frames, halt once the pool is full */
+        if (zero_pool_refill()) continue;
+        
+        /* Stop the periodic tick for the halt if nothing else can run */
+        __asm__ volatile ("cli");
+        if (!scheduler_runnable()) {
+            timer_idle_enter();
+            __asm__ volatile ("sti; hlt; cli"); /* Halt until next interrupt */
+            timer_idle_exit();
+        }
+        __asm__ volatile ("sti");
+        
+        /* Hand the CPU straight to whatever the interrupt woke */
+        if (scheduler_runnable()) process_yield();
     }
 }
 
@@ -242,4 +200,11 @@ uint8_t inb(uint16_t port) {
 
 void outb(uint16_t port, uint8_t data) {
     __asm__ volatile ("outb %1, %0" : : "dN"(port), "a"(data));
+}
+
+/* Time stamp counter */
+uint64_t rdtsc(void) {
+    uint32_t low, high;
+    __asm__ volatile ("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
 }
\ No newline at end of file
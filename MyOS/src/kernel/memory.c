@@ -1,204 +1,765 @@
 #include "memory.h"
 #include "kernel.h"
 #include "vga.h"
+#include "multiboot.h"
+#include "cmdline.h"
+#include "cpu.h"
+#include "smp.h"
+
+/* End of the kernel image (virtual), provided by linker.ld */
+extern uint8_t kernel_end[];
 
 /* Global memory management variables */
 static uint32_t total_memory = 0;
 static uint32_t used_memory = 0;
-static uint32_t kernel_end = 0;
-static memory_block_t* memory_blocks = NULL;
+static uint32_t placement_address = 0;   /* Physical */
 static page_directory_t* kernel_directory = NULL;
-static page_directory_t* current_directory = NULL;
 
-/* Bitmap for physical page allocation */
-static uint32_t* page_bitmap = NULL;
-static uint32_t page_bitmap_size = 0;
+/* Kernel heap for objects too large for the slab allocator (virtual addresses) */
+static uint32_t heap_start = 0;
+static uint32_t heap_end = 0;
+static memory_block_t* heap_bins[HEAP_BINS];   /* Segregated free lists */
+static uint32_t heap_bin_map = 0;              /* Bit set for each non-empty bin */
+
+/* Frame descriptors, indexed by physical page number */
+static page_t* mem_map = NULL;
+
+/* Physical frame allocator backend, selected with frames= on the command line */
+static const frame_allocator_t* frame_allocator = &buddy_frame_allocator;
+
+/* Physical page frames */
 static uint32_t total_pages = 0;
 
-void memory_init(uint32_t mem_lower, uint32_t mem_upper) {
-    total_memory = (mem_lower + mem_upper) * 1024; /* Convert KB to bytes */
-    kernel_end = MEMORY_KERNEL_END;
-    used_memory = kernel_end - MEMORY_KERNEL_START;
+/* Physical memory regions reported by the boot loader */
+typedef struct memory_region {
+    uint32_t start;
+    uint32_t end;
+    uint32_t type;
+} memory_region_t;
+
+static memory_region_t memory_regions[MAX_MEMORY_REGIONS];
+static uint32_t memory_region_count = 0;
+
+/* Physical ranges that must never reach the frame allocator, sorted by start */
+static memory_region_t reserved_ranges[MAX_MEMORY_REGIONS];
+static uint32_t reserved_count = 0;
+
+/* Boundary tag helpers for the kernel heap */
+#define BLOCK_FOOTER_SIZE sizeof(uint32_t)
+#define BLOCK_OVERHEAD (sizeof(memory_block_t) + BLOCK_FOOTER_SIZE)
+#define BLOCK_MIN_SPLIT 16
+
+static inline void* block_payload(memory_block_t* block) {
+    return (void*)(block + 1);
+}
+
+static inline uint32_t* block_footer(memory_block_t* block) {
+    return (uint32_t*)((uint8_t*)(block + 1) + block->size);
+}
+
+static inline void block_set_size(memory_block_t* block, uint32_t size) {
+    block->size = size;
+    *block_footer(block) = size;
+}
+
+static inline memory_block_t* block_next(memory_block_t* block) {
+    memory_block_t* next = (memory_block_t*)((uint8_t*)block_footer(block) + BLOCK_FOOTER_SIZE);
+    return ((uint32_t)next < heap_end) ? next : NULL;
+}
+
+static inline memory_block_t* block_prev(memory_block_t* block) {
+    if ((uint32_t)block <= heap_start) return NULL;
+    uint32_t prev_size = *((uint32_t*)block - 1);
+    return (memory_block_t*)((uint8_t*)block - BLOCK_FOOTER_SIZE - prev_size) - 1;
+}
+
+static uint32_t heap_bin_index(uint32_t size) {
+    uint32_t shift = 31 - __builtin_clz(size);
+    if (shift < HEAP_MIN_BIN_SHIFT) return 0;
+    shift -= HEAP_MIN_BIN_SHIFT;
+    return (shift < HEAP_BINS) ? shift : HEAP_BINS - 1;
+}
+
+static void heap_bin_insert(memory_block_t* block) {
+    uint32_t bin = heap_bin_index(block->size);
+    block->free = 1;
+    block->prev_free = NULL;
+    block->next_free = heap_bins[bin];
+    if (heap_bins[bin]) heap_bins[bin]->prev_free = block;
+    heap_bins[bin] = block;
+    heap_bin_map |= 1 << bin;
+}
+
+static void heap_bin_remove(memory_block_t* block) {
+    uint32_t bin = heap_bin_index(block->size);
+    if (block->prev_free) block->prev_free->next_free = block->next_free;
+    else heap_bins[bin] = block->next_free;
+    if (block->next_free) block->next_free->prev_free = block->prev_free;
+    if (!heap_bins[bin]) heap_bin_map &= ~(1 << bin);
+    block->free = 0;
+    block->next_free = NULL;
+    block->prev_free = NULL;
+}
+
+static memory_block_t* heap_find_block(uint32_t size) {
+    uint32_t bin = heap_bin_index(size);
+    
+    /* The block's own bin holds mixed sizes, so it needs a first-fit pass */
+    for (memory_block_t* block = heap_bins[bin]; block; block = block->next_free) {
+        if (block->size >= size) return block;
+    }
+    
+    /* Every block in a higher bin is large enough */
+    uint32_t higher = (bin + 1 < HEAP_BINS) ? heap_bin_map & ~((2u << bin) - 1) : 0;
+    if (!higher) return NULL;
+    return heap_bins[__builtin_ctz(higher)];
+}
+
+static void memory_add_boot_region(uint64_t addr, uint64_t len, uint32_t type) {
+    if (memory_region_count >= MAX_MEMORY_REGIONS) return;
+    if (addr >= 0x100000000ULL || len == 0) return; /* Not addressable without PAE */
+    
+    uint64_t end = addr + len;
+    if (end > 0x100000000ULL) end = 0x100000000ULL - PAGE_SIZE;
+    
+    memory_regions[memory_region_count].start = (uint32_t)addr;
+    memory_regions[memory_region_count].end = (uint32_t)end;
+    memory_regions[memory_region_count].type = type;
+    memory_region_count++;
+}
+
+static void memory_reserve(uint32_t start, uint32_t end) {
+    if (reserved_count >= MAX_MEMORY_REGIONS) {
+        kernel_panic("Too many reserved memory ranges");
+    }
+    
+    start &= ~(PAGE_SIZE - 1);
+    end = (end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    
+    /* Insertion sort keeps the list ordered for memory_add_region() */
+    uint32_t i = reserved_count++;
+    while (i > 0 && reserved_ranges[i - 1].start > start) {
+        reserved_ranges[i] = reserved_ranges[i - 1];
+        i--;
+    }
+    reserved_ranges[i].start = start;
+    reserved_ranges[i].end = end;
+    reserved_ranges[i].type = MULTIBOOT_MEMORY_RESERVED;
+}
+
+/* Give [start, end) to the frame allocator minus any reserved ranges */
+static uint32_t memory_add_region(uint32_t start, uint32_t end) {
+    uint32_t pages = 0;
+    uint32_t cursor = (start + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    end &= ~(PAGE_SIZE - 1);
+    
+    for (uint32_t i = 0; i < reserved_count && cursor < end; i++) {
+        memory_region_t* reserved = &reserved_ranges[i];
+        if (reserved->end <= cursor) continue;
+        if (reserved->start >= end) break;
+        
+        if (reserved->start > cursor) {
+            frame_allocator->add_range(cursor, reserved->start);
+            pages += (reserved->start - cursor) / PAGE_SIZE;
+        }
+        cursor = reserved->end;
+    }
+    
+    if (cursor < end) {
+        frame_allocator->add_range(cursor, end);
+        pages += (end - cursor) / PAGE_SIZE;
+    }
+    
+    return pages;
+}
+
+static const char* memory_region_type(uint32_t type) {
+    switch (type) {
+        case MULTIBOOT_MEMORY_AVAILABLE: return "available";
+        case MULTIBOOT_MEMORY_ACPI: return "ACPI";
+        case MULTIBOOT_MEMORY_NVS: return "ACPI NVS";
+        case MULTIBOOT_MEMORY_BADRAM: return "bad RAM";
+        default: return "reserved";
+    }
+}
+
+void memory_init(struct multiboot_info* mboot) {
+    memory_region_count = 0;
+    reserved_count = 0;
+    
+    /* Collect the physical memory map, preferring the full e820 map */
+    if (mboot->flags & MULTIBOOT_INFO_MEM_MAP) {
+        uint32_t entry_addr = (uint32_t)PHYS_TO_VIRT(mboot->mmap_addr);
+        uint32_t mmap_end = entry_addr + mboot->mmap_length;
+        while (entry_addr < mmap_end) {
+            multiboot_mmap_entry_t* entry = (multiboot_mmap_entry_t*)entry_addr;
+            memory_add_boot_region(entry->addr, entry->len, entry->type);
+            entry_addr += entry->size + sizeof(entry->size);
+        }
+    } else if (mboot->flags & MULTIBOOT_INFO_MEMORY) {
+        memory_add_boot_region(0, mboot->mem_lower * 1024, MULTIBOOT_MEMORY_AVAILABLE);
+        memory_add_boot_region(MEMORY_KERNEL_START, mboot->mem_upper * 1024, MULTIBOOT_MEMORY_AVAILABLE);
+    } else {
+        kernel_panic("No memory information from boot loader");
+    }
+    
+    /* Frame descriptors must cover the highest available address the kernel can reach */
+    uint32_t highest_address = 0;
+    for (uint32_t i = 0; i < memory_region_count; i++) {
+        if (memory_regions[i].type == MULTIBOOT_MEMORY_AVAILABLE &&
+            memory_regions[i].end > highest_address) {
+            highest_address = memory_regions[i].end;
+        }
+    }
+    if (highest_address > KERNEL_DIRECT_MAP_SIZE) {
+        highest_address = KERNEL_DIRECT_MAP_SIZE;
+    }
+    
+    /* Keep the null page, the AP startup page, boot loader data and modules
+     * away from the allocator */
+    memory_reserve(0, PAGE_SIZE);
+    memory_reserve(AP_TRAMPOLINE_PHYS, AP_TRAMPOLINE_PHYS + PAGE_SIZE);
+    memory_reserve(VIRT_TO_PHYS(mboot), VIRT_TO_PHYS(mboot) + sizeof(struct multiboot_info));
+    if (mboot->flags & MULTIBOOT_INFO_MEM_MAP) {
+        memory_reserve(mboot->mmap_addr, mboot->mmap_addr + mboot->mmap_length);
+    }
+    if (mboot->flags & MULTIBOOT_INFO_CMDLINE) {
+        memory_reserve(mboot->cmdline, mboot->cmdline + strlen(PHYS_TO_VIRT(mboot->cmdline)) + 1);
+    }
+    if (mboot->flags & MULTIBOOT_INFO_MODS) {
+        multiboot_module_t* mods = PHYS_TO_VIRT(mboot->mods_addr);
+        memory_reserve(mboot->mods_addr, mboot->mods_addr + mboot->mods_count * sizeof(multiboot_module_t));
+        for (uint32_t i = 0; i < mboot->mods_count; i++) {
+            memory_reserve(mods[i].mod_start, mods[i].mod_end);
+            if (mods[i].cmdline) {
+                memory_reserve(mods[i].cmdline, mods[i].cmdline + strlen(PHYS_TO_VIRT(mods[i].cmdline)) + 1);
+            }
+        }
+    }
+    
+    /* Metadata goes after the kernel image and any boot data loaded above it */
+    placement_address = VIRT_TO_PHYS(kernel_end);
+    for (uint32_t i = 0; i < reserved_count; i++) {
+        if (reserved_ranges[i].start >= MEMORY_KERNEL_START &&
+            reserved_ranges[i].end > placement_address) {
+            placement_address = reserved_ranges[i].end;
+        }
+    }
+    placement_address = (placement_address + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    used_memory = VIRT_TO_PHYS(kernel_end) - MEMORY_KERNEL_START;
+    
+    /* Allocate frame descriptors */
+    total_pages = highest_address / PAGE_SIZE;
+    mem_map = PHYS_TO_VIRT(placement_address);
+    placement_address += total_pages * sizeof(page_t);
+    memset(mem_map, 0, total_pages * sizeof(page_t));
+    
+    /* Pick the frame allocator and give it room for its own metadata */
+    const char* frames = cmdline_get("frames");
+    if (frames && strcmp(frames, "bitmap") == 0) {
+        frame_allocator = &bitmap_frame_allocator;
+    }
+    uint32_t frame_metadata = (uint32_t)PHYS_TO_VIRT(placement_address);
+    placement_address += frame_allocator->metadata_size(total_pages);
+    
+    /* Reserve the kernel heap right after the metadata */
+    heap_start = (uint32_t)PHYS_TO_VIRT((placement_address + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+    heap_end = heap_start + KERNEL_HEAP_SIZE;
+    memory_reserve(MEMORY_KERNEL_START, VIRT_TO_PHYS(heap_end));
     
     vga_printf("Memory initialization:\n");
-    vga_printf("  Lower memory: %d KB\n", mem_lower);
-    vga_printf("  Upper memory: %d KB\n", mem_upper);
-    vga_printf("  Total memory: %d KB\n", total_memory / 1024);
     vga_printf("  Kernel size: %d KB\n", used_memory / 1024);
+    vga_printf("  Memory map:\n");
     
-    /* Initialize physical page bitmap */
-    total_pages = total_memory / PAGE_SIZE;
-    page_bitmap_size = (total_pages + 31) / 32; /* 32 bits per uint32_t */
-    page_bitmap = (uint32_t*)(kernel_end);
-    kernel_end += page_bitmap_size * sizeof(uint32_t);
-    
-    /* Mark all pages as used initially */
-    for (uint32_t i = 0; i < page_bitmap_size; i++) {
-        page_bitmap[i] = 0xFFFFFFFF;
+    /* Hand every available region to the frame allocator */
+    frame_allocator->init(total_pages, frame_metadata);
+    total_memory = 0;
+    for (uint32_t i = 0; i < memory_region_count; i++) {
+        memory_region_t* region = &memory_regions[i];
+        vga_printf("    0x%x - 0x%x %s, %d KB", region->start, region->end,
+                   memory_region_type(region->type), (region->end - region->start) / 1024);
+        
+        if (region->type == MULTIBOOT_MEMORY_AVAILABLE && region->start < KERNEL_DIRECT_MAP_SIZE) {
+            uint32_t end = (region->end < KERNEL_DIRECT_MAP_SIZE) ? region->end : KERNEL_DIRECT_MAP_SIZE;
+            uint32_t pages = memory_add_region(region->start, end);
+            total_memory += end - region->start;
+            vga_printf(", %d pages usable", pages);
+        }
+        vga_putchar('\n');
     }
     
-    /* Mark available pages as free */
-    uint32_t available_start = kernel_end / PAGE_SIZE;
-    uint32_t available_end = total_memory / PAGE_SIZE;
+    vga_printf("  Total memory: %d KB\n", total_memory / 1024);
+    vga_printf("  Free pages: %d (%s allocator)\n", frame_allocator->free_pages(), frame_allocator->name);
     
-    for (uint32_t i = available_start; i < available_end; i++) {
-        uint32_t index = i / 32;
-        uint32_t bit = i % 32;
-        page_bitmap[index] &= ~(1 << bit);
+    /* Initialize kernel heap as a single free block */
+    for (uint32_t i = 0; i < HEAP_BINS; i++) {
+        heap_bins[i] = NULL;
     }
+    heap_bin_map = 0;
+    memory_block_t* block = (memory_block_t*)heap_start;
+    block_set_size(block, KERNEL_HEAP_SIZE - BLOCK_OVERHEAD);
+    heap_bin_insert(block);
     
-    /* Initialize kernel heap */
-    memory_blocks = (memory_block_t*)kernel_end;
-    memory_blocks->address = kernel_end + sizeof(memory_block_t);
-    memory_blocks->size = MEMORY_USER_START - memory_blocks->address;
-    memory_blocks->free = 1;
-    memory_blocks->next = NULL;
+    slab_init();
+    zero_pool_init();
     
     vga_puts("Physical memory manager initialized\n");
 }
 
 void paging_init(void) {
     /* Create kernel page directory */
-    kernel_directory = (page_directory_t*)kmalloc(sizeof(page_directory_t));
-    memset(kernel_directory, 0, sizeof(page_directory_t));
+    uint32_t directory_phys = alloc_zeroed_page();
+    if (!directory_phys) {
+        kernel_panic("Out of memory for the kernel page directory");
+    }
+    kernel_directory = PHYS_TO_VIRT(directory_phys);
     
-    /* Identity map the first 4MB (kernel space) */
-    for (uint32_t i = 0; i < 1024; i++) {
-        uint32_t physical_addr = i * PAGE_SIZE;
-        map_page(physical_addr, physical_addr, PAGE_PRESENT | PAGE_WRITE);
+    /* Map low physical memory into the higher half with global 4MB pages.
+     * Global entries are not flushed by CR3 loads, so kernel TLB entries
+     * survive address space switches. */
+    for (uint32_t i = 0; i < KERNEL_DIRECT_MAP_PDES; i++) {
+        page_directory_entry_t* entry = &kernel_directory->entries[KERNEL_PAGE_NUMBER + i];
+        entry->address = (i << 22) >> 12;
+        entry->present = 1;
+        entry->write = 1;
+        entry->page_size = 1;
+        entry->global = 1;
+    }
+    
+    /* Preallocate page tables for the rest of the kernel half so the kernel
+     * entries never change and can simply be copied into new directories */
+    for (uint32_t i = KERNEL_PAGE_NUMBER + KERNEL_DIRECT_MAP_PDES; i < FOREIGN_PDE; i++) {
+        uint32_t table_phys = alloc_zeroed_page();
+        if (!table_phys) {
+            kernel_panic("Out of memory for kernel page tables");
+        }
+        kernel_directory->entries[i].address = table_phys >> 12;
+        kernel_directory->entries[i].present = 1;
+        kernel_directory->entries[i].write = 1;
     }
     
-    /* Switch to our page directory */
+    /* The last entry maps the directory onto itself, exposing all page
+     * tables at PAGE_TABLES_VIRT once paging uses this directory */
+    kernel_directory->entries[RECURSIVE_PDE].address = directory_phys >> 12;
+    kernel_directory->entries[RECURSIVE_PDE].present = 1;
+    kernel_directory->entries[RECURSIVE_PDE].write = 1;
+    
+    /* Switch to our page directory, replacing the one built in boot.asm */
     switch_page_directory(kernel_directory);
     
-    /* Enable paging */
+    /* CR0.WP makes kernel writes to copy-on-write pages fault as well */
     uint32_t cr0;
     __asm__ volatile ("mov %%cr0, %0" : "=r"(cr0));
-    cr0 |= 0x80000000; /* Set PG bit */
-    __asm__ volatile ("mov %0, %%cr0" : : "r"(cr0));
+    __asm__ volatile ("mov %0, %%cr0" : : "r"(cr0 | 0x10000));
     
-    vga_puts("Paging enabled\n");
+    /* Paging, CR4.PSE and CR4.PGE are already enabled by boot.asm */
+    vga_printf("Paging enabled: %d MB kernel window at 0x%x, 4MB global pages\n",
+               KERNEL_DIRECT_MAP_SIZE >> 20, KERNEL_VIRTUAL_BASE);
 }
 
-void* kmalloc(uint32_t size) {
+static void* kmalloc_internal(uint32_t size) {
+    /* Small objects come from the slab size classes */
+    if (size <= SLAB_MAX_SIZE) {
+        void* obj = slab_alloc(size);
+        if (obj) return obj;
+    }
+    
     /* Align size to 4-byte boundary */
     size = (size + 3) & ~3;
+    if (size < BLOCK_MIN_SPLIT) size = BLOCK_MIN_SPLIT;
     
-    memory_block_t* block = memory_blocks;
-    while (block) {
-        if (block->free && block->size >= size) {
-            /* Split block if it's much larger than needed */
-            if (block->size > size + sizeof(memory_block_t) + 16) {
-                memory_block_t* new_block = (memory_block_t*)(block->address + size);
-                new_block->address = block->address + size + sizeof(memory_block_t);
-                new_block->size = block->size - size - sizeof(memory_block_t);
-                new_block->free = 1;
-                new_block->next = block->next;
-                
-                block->size = size;
-                block->next = new_block;
-            }
-            
-            block->free = 0;
-            used_memory += size;
-            return (void*)block->address;
-        }
-        block = block->next;
+    memory_block_t* block = heap_find_block(size);
+    if (!block) return NULL; /* Out of memory */
+    
+    heap_bin_remove(block);
+    
+    /* Split block if it's much larger than needed */
+    if (block->size >= size + BLOCK_OVERHEAD + BLOCK_MIN_SPLIT) {
+        uint32_t remainder = block->size - size - BLOCK_OVERHEAD;
+        block_set_size(block, size);
+        
+        memory_block_t* new_block = block_next(block);
+        block_set_size(new_block, remainder);
+        heap_bin_insert(new_block);
+    }
+    
+    used_memory += block->size;
+    return block_payload(block);
+}
+
+void* kmalloc(uint32_t size) {
+    uint32_t flags = irq_save();
+    void* ptr = kmalloc_internal(size);
+#ifdef CONFIG_KMALLOC_PROFILE
+    if (ptr) kmalloc_profile_alloc(ptr, size, __builtin_return_address(0));
+#endif
+    irq_restore(flags);
+    return ptr;
+}
+
+static void kfree_internal(void* ptr) {
+#ifdef CONFIG_KMALLOC_PROFILE
+    kmalloc_profile_free(ptr);
+#endif
+    
+    /* Anything outside the heap was handed out by the slab allocator */
+    if ((uint32_t)ptr < heap_start || (uint32_t)ptr >= heap_end) {
+        slab_free(ptr);
+        return;
     }
     
-    return NULL; /* Out of memory */
+    memory_block_t* block = (memory_block_t*)ptr - 1;
+    if (block->free) return; /* Double free */
+    
+    used_memory -= block->size;
+    
+    /* Merge with next block if it's free */
+    memory_block_t* next = block_next(block);
+    if (next && next->free) {
+        heap_bin_remove(next);
+        block_set_size(block, block->size + BLOCK_OVERHEAD + next->size);
+    }
+    
+    /* Merge with previous block if it's free */
+    memory_block_t* prev = block_prev(block);
+    if (prev && prev->free) {
+        heap_bin_remove(prev);
+        block_set_size(prev, prev->size + BLOCK_OVERHEAD + block->size);
+        block = prev;
+    }
+    
+    heap_bin_insert(block);
 }
 
 void kfree(void* ptr) {
     if (!ptr) return;
     
-    memory_block_t* block = memory_blocks;
-    while (block) {
-        if (block->address == (uint32_t)ptr) {
-            block->free = 1;
-            used_memory -= block->size;
-            
-            /* Merge with next block if it's free */
-            if (block->next && block->next->free) {
-                block->size += block->next->size + sizeof(memory_block_t);
-                block->next = block->next->next;
-            }
-            
-            /* Merge with previous block if it's free */
-            memory_block_t* prev = memory_blocks;
-            while (prev && prev->next != block) {
-                prev = prev->next;
-            }
-            if (prev && prev->free) {
-                prev->size += block->size + sizeof(memory_block_t);
-                prev->next = block->next;
-            }
-            
-            return;
+    uint32_t flags = irq_save();
+    kfree_internal(ptr);
+    irq_restore(flags);
+}
+
+void heap_get_stats(uint32_t* free_bytes, uint32_t* largest_free) {
+    uint32_t total = 0;
+    uint32_t largest = 0;
+    
+    for (uint32_t bin = 0; bin < HEAP_BINS; bin++) {
+        for (memory_block_t* block = heap_bins[bin]; block; block = block->next_free) {
+            total += block->size;
+            if (block->size > largest) largest = block->size;
         }
-        block = block->next;
     }
+    
+    if (free_bytes) *free_bytes = total;
+    if (largest_free) *largest_free = largest;
+}
+
+/* The heap and frame allocators are shared by every CPU and by interrupt
+ * handlers, irq_save() covers both */
+uint32_t alloc_pages(uint32_t order) {
+    uint32_t flags = irq_save();
+    uint32_t addr = frame_allocator->alloc(order);
+    irq_restore(flags);
+    return addr;
+}
+
+void free_pages(uint32_t addr, uint32_t order) {
+    uint32_t flags = irq_save();
+    frame_allocator->free(addr, order);
+    irq_restore(flags);
 }
 
 uint32_t alloc_page(void) {
-    for (uint32_t i = 0; i < page_bitmap_size; i++) {
-        if (page_bitmap[i] != 0xFFFFFFFF) {
-            for (int bit = 0; bit < 32; bit++) {
-                if (!(page_bitmap[i] & (1 << bit))) {
-                    page_bitmap[i] |= (1 << bit);
-                    return (i * 32 + bit) * PAGE_SIZE;
-                }
-            }
-        }
-    }
-    return 0; /* Out of physical memory */
+    return alloc_pages(0);
 }
 
 void free_page(uint32_t page) {
-    uint32_t page_num = page / PAGE_SIZE;
-    uint32_t index = page_num / 32;
-    uint32_t bit = page_num % 32;
+    free_pages(page, 0);
+}
+
+page_t* phys_to_page(uint32_t addr) {
+    uint32_t page_num = addr / PAGE_SIZE;
+    if (page_num >= total_pages) return NULL;
+    return &mem_map[page_num];
+}
+
+uint32_t page_to_phys(page_t* page) {
+    return (uint32_t)(page - mem_map) * PAGE_SIZE;
+}
+
+/* A mapped user frame without a count has a single owner */
+void page_ref(uint32_t addr) {
+    page_t* page = phys_to_page(addr);
+    if (!page) return;
     
-    if (index < page_bitmap_size) {
-        page_bitmap[index] &= ~(1 << bit);
+    if (page->refcount == 0) page->refcount = 1;
+    page->refcount++;
+}
+
+/* Drop one mapping of a user frame, freeing it with the last one */
+void page_unref(uint32_t addr) {
+    page_t* page = phys_to_page(addr);
+    if (!page) return;
+    
+    if (page->refcount > 1) {
+        page->refcount--;
+        return;
     }
+    page->refcount = 0;
+    free_page(addr);
+}
+
+static inline void tlb_invalidate(uint32_t virtual_addr) {
+    __asm__ volatile ("invlpg (%0)" : : "r"(virtual_addr) : "memory");
 }
 
-void map_page(uint32_t virtual_addr, uint32_t physical_addr, uint32_t flags) {
+/* Reload CR3, flushing every non-global TLB entry */
+void tlb_flush_all(void) {
+    uint32_t cr3;
+    __asm__ volatile ("mov %%cr3, %0" : "=r"(cr3));
+    __asm__ volatile ("mov %0, %%cr3" : : "r"(cr3) : "memory");
+}
+
+/* One flush for a whole batch: per-page invlpg for short ranges, CR3 reload otherwise */
+void tlb_flush_range(uint32_t virtual_addr, uint32_t count) {
+    if (count > TLB_FLUSH_CEILING) {
+        tlb_flush_all();
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        tlb_invalidate(virtual_addr + i * PAGE_SIZE);
+    }
+}
+
+/* Make a directory that is not loaded in CR3 reachable through the foreign
+ * window. The window is an entry of the loaded directory, which other CPUs
+ * may have loaded as well and pointed elsewhere since this one last used it. */
+static void attach_foreign_directory(page_directory_t* dir) {
+    cpu_t* cpu = this_cpu();
+    page_directory_t* self = (page_directory_t*)PAGE_DIRECTORY_VIRT;
+    page_directory_entry_t* window = &self->entries[FOREIGN_PDE];
+    if (cpu->foreign == dir && window->present &&
+        window->address == VIRT_TO_PHYS(dir) >> 12) {
+        return;
+    }
+    
+    window->address = VIRT_TO_PHYS(dir) >> 12;
+    window->present = 1;
+    window->write = 1;
+    
+    /* Drop translations left over from the previously attached directory */
+    tlb_flush_all();
+    cpu->foreign = dir;
+}
+
+/* Find the PTE for virtual_addr in dir (NULL for the current directory). A missing
+ * page table is created when create_flags is non-zero; PAGE_USER in it also
+ * opens the directory entry to user mode. */
+page_table_entry_t* get_page_entry(page_directory_t* dir, uint32_t virtual_addr, uint32_t create_flags) {
     uint32_t page_dir_index = virtual_addr >> 22;
     uint32_t page_table_index = (virtual_addr >> 12) & 0x3FF;
     
-    page_directory_entry_t* dir_entry = &current_directory->entries[page_dir_index];
+    /* Both windows are only valid while the tables they point at are in use */
+    if (page_dir_index >= FOREIGN_PDE) return NULL;
+    
+    page_directory_t* directory;
+    uint32_t tables;
+    if (!dir || dir == this_cpu()->directory) {
+        directory = (page_directory_t*)PAGE_DIRECTORY_VIRT;
+        tables = PAGE_TABLES_VIRT;
+    } else {
+        attach_foreign_directory(dir);
+        directory = (page_directory_t*)FOREIGN_DIRECTORY_VIRT;
+        tables = FOREIGN_TABLES_VIRT;
+    }
+    
+    page_directory_entry_t* dir_entry = &directory->entries[page_dir_index];
+    page_table_t* page_table = (page_table_t*)(tables + page_dir_index * PAGE_SIZE);
+    
+    /* Addresses covered by a 4MB page cannot be remapped page by page */
+    if (dir_entry->present && dir_entry->page_size) return NULL;
     
     if (!dir_entry->present) {
-        /* Create new page table */
-        uint32_t page_table_phys = alloc_page();
-        if (!page_table_phys) return;
+        if (!create_flags) return NULL;
         
-        page_table_t* page_table = (page_table_t*)page_table_phys;
-        memset(page_table, 0, sizeof(page_table_t));
+        /* Create new page table */
+        uint32_t page_table_phys = alloc_zeroed_page();
+        if (!page_table_phys) return NULL;
         
         dir_entry->address = page_table_phys >> 12;
         dir_entry->present = 1;
         dir_entry->write = 1;
-        dir_entry->user = (flags & PAGE_USER) ? 1 : 0;
+        
+        /* The new table shows up in the window at a fixed address */
+        tlb_invalidate((uint32_t)page_table);
     }
     
-    page_table_t* page_table = (page_table_t*)(dir_entry->address << 12);
-    page_table_entry_t* table_entry = &page_table->entries[page_table_index];
+    if (create_flags & PAGE_USER) dir_entry->user = 1;
     
-    table_entry->address = physical_addr >> 12;
-    table_entry->present = (flags & PAGE_PRESENT) ? 1 : 0;
-    table_entry->write = (flags & PAGE_WRITE) ? 1 : 0;
-    table_entry->user = (flags & PAGE_USER) ? 1 : 0;
+    return &page_table->entries[page_table_index];
+}
+
+static inline void set_page_entry(page_table_entry_t* entry, uint32_t physical_addr, uint32_t flags) {
+    entry->address = physical_addr >> 12;
+    entry->present = (flags & PAGE_PRESENT) ? 1 : 0;
+    entry->write = (flags & PAGE_WRITE) ? 1 : 0;
+    entry->user = (flags & PAGE_USER) ? 1 : 0;
+    entry->writethrough = (flags & PAGE_WRITETHROUGH) ? 1 : 0;
+    entry->cache_disable = (flags & PAGE_NOCACHE) ? 1 : 0;
+    entry->global = (flags & PAGE_GLOBAL) ? 1 : 0;
+    entry->available = (flags & PAGE_COW) ? 1 : 0;
+}
+
+int map_page(uint32_t virtual_addr, uint32_t physical_addr, uint32_t flags) {
+    return map_range(virtual_addr, physical_addr, 1, flags);
+}
+
+void unmap_page(uint32_t virtual_addr) {
+    unmap_range(virtual_addr, 1);
+}
+
+void map_page_in(page_directory_t* dir, uint32_t virtual_addr, uint32_t physical_addr, uint32_t flags) {
+    page_table_entry_t* entry = get_page_entry(dir, virtual_addr, flags | PAGE_PRESENT);
+    if (!entry) return;
     
-    /* Invalidate TLB entry */
-    __asm__ volatile ("invlpg (%0)" : : "r"(virtual_addr) : "memory");
+    int was_present = entry->present;
+    set_page_entry(entry, physical_addr, flags);
+    
+    /* A directory that is not loaded has nothing cached for this address */
+    if (was_present && (!dir || dir == this_cpu()->directory)) {
+        tlb_invalidate(virtual_addr);
+    }
+}
+
+/* Returns 0 if a page table could not be allocated; the entries already set
+ * are cleared again so the range is never left half mapped */
+int map_range(uint32_t virtual_addr, uint32_t physical_addr, uint32_t count, uint32_t flags) {
+    int replaced = 0;
+    
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t offset = i * PAGE_SIZE;
+        page_table_entry_t* entry = get_page_entry(NULL, virtual_addr + offset, flags | PAGE_PRESENT);
+        if (!entry) {
+            unmap_range(virtual_addr, i);
+            return 0;
+        }
+        
+        if (entry->present) replaced = 1;
+        set_page_entry(entry, physical_addr + offset, flags);
+    }
+    
+    /* Entries that were not present cannot be cached, so only overwrites need a flush */
+    if (replaced) {
+        tlb_flush_range(virtual_addr, count);
+    }
+    return 1;
+}
+
+void unmap_range(uint32_t virtual_addr, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        page_table_entry_t* entry = get_page_entry(NULL, virtual_addr + i * PAGE_SIZE, 0);
+        if (entry) {
+            *(uint32_t*)entry = 0;
+        }
+    }
+    
+    tlb_flush_range(virtual_addr, count);
+}
+
+page_directory_t* create_page_directory(void) {
+    uint32_t directory_phys = alloc_zeroed_page();
+    if (!directory_phys) return NULL;
+    
+    page_directory_t* dir = PHYS_TO_VIRT(directory_phys);
+    
+    /* Kernel page tables are preallocated, so sharing the entries keeps every
+     * address space's view of the kernel in sync */
+    for (uint32_t i = KERNEL_PAGE_NUMBER; i < FOREIGN_PDE; i++) {
+        dir->entries[i] = kernel_directory->entries[i];
+    }
+    
+    dir->entries[RECURSIVE_PDE].address = directory_phys >> 12;
+    dir->entries[RECURSIVE_PDE].present = 1;
+    dir->entries[RECURSIVE_PDE].write = 1;
+    
+    return dir;
+}
+
+/* Duplicate the current address space for fork. Writable user pages become
+ * read-only and PAGE_COW in both directories, so only page tables are copied
+ * here and the frames themselves on the first write. */
+page_directory_t* clone_page_directory(void) {
+    page_directory_t* child = create_page_directory();
+    if (!child) return NULL;
+    
+    page_directory_t* self = (page_directory_t*)PAGE_DIRECTORY_VIRT;
+    for (uint32_t i = 0; i < KERNEL_PAGE_NUMBER; i++) {
+        page_directory_entry_t* dir_entry = &self->entries[i];
+        if (!dir_entry->present || dir_entry->page_size) continue;
+        
+        page_table_t* table = (page_table_t*)(PAGE_TABLES_VIRT + i * PAGE_SIZE);
+        page_table_entry_t* copy = get_page_entry(child, i << 22,
+                                                  PAGE_PRESENT | PAGE_WRITE | PAGE_USER);
+        if (!copy) {
+            free_page_directory(child);
+            return NULL;
+        }
+        
+        for (uint32_t j = 0; j < PAGE_ENTRIES; j++) {
+            page_table_entry_t* entry = &table->entries[j];
+            if (!entry->present) continue;
+            
+            if (entry->write) {
+                entry->write = 0;
+                entry->available |= 1;
+            }
+            copy[j] = *entry;
+            page_ref(entry->address << 12);
+        }
+    }
+    
+    /* Our own entries lost their write permission */
+    tlb_flush_all();
+    return child;
+}
+
+/* Release the user half of an address space that is not loaded, then the
+ * directory itself. Kernel page tables are shared and stay put. */
+void free_page_directory(page_directory_t* dir) {
+    if (!dir || dir == this_cpu()->directory || dir == kernel_directory) return;
+    
+    for (uint32_t i = 0; i < KERNEL_PAGE_NUMBER; i++) {
+        page_table_entry_t* table = get_page_entry(dir, i << 22, 0);
+        if (!table) continue;
+        
+        for (uint32_t j = 0; j < PAGE_ENTRIES; j++) {
+            if (table[j].present) page_unref(table[j].address << 12);
+        }
+        free_page(dir->entries[i].address << 12);
+    }
+    
+    /* No CPU's window may keep pointing at a freed directory, a new one
+     * allocated in its place would look attached already */
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        if (cpus[i].foreign == dir) cpus[i].foreign = NULL;
+    }
+    free_page(VIRT_TO_PHYS(dir));
 }
 
 void switch_page_directory(page_directory_t* dir) {
-    current_directory = dir;
-    __asm__ volatile ("mov %0, %%cr3" : : "r"(dir) : "memory");
+    cpu_t* cpu = this_cpu();
+    cpu->directory = dir;
+    cpu->foreign = NULL;
+    __asm__ volatile ("mov %0, %%cr3" : : "r"(VIRT_TO_PHYS(dir)) : "memory");
+}
+
+/* The directory loaded on this CPU */
+page_directory_t* current_page_directory(void) {
+    return this_cpu()->directory;
+}
+
+page_directory_t* kernel_page_directory(void) {
+    return kernel_directory;
 }
 
 void memory_info(void) {
@@ -211,19 +772,16 @@ void memory_info(void) {
     vga_printf("Free memory:  %d KB\n", (total_memory - used_memory) / 1024);
     vga_printf("Total pages:  %d\n", total_pages);
     
-    /* Count free pages */
-    uint32_t free_pages = 0;
-    for (uint32_t i = 0; i < page_bitmap_size; i++) {
-        for (int bit = 0; bit < 32; bit++) {
-            if (!(page_bitmap[i] & (1 << bit))) {
-                free_pages++;
-            }
-        }
-    }
-    
+    uint32_t free_pages = frame_allocator->free_pages();
     vga_printf("Free pages:   %d\n", free_pages);
     vga_printf("Used pages:   %d\n", total_pages - free_pages);
     
+    frame_allocator->info();
+    
+    slab_info();
+    zero_pool_info();
+    vmalloc_info();
+    
     vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
 }
 
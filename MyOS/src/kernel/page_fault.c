@@ -0,0 +1,94 @@
+#include "memory.h"
+#include "interrupts.h"
+#include "process.h"
+#include "kernel.h"
+#include "vga.h"
+
+/* Page fault error code bits */
+#define PF_PRESENT  0x1     /* Protection violation rather than a missing page */
+#define PF_WRITE    0x2
+#define PF_USER     0x4
+
+static inline uint32_t read_cr2(void) {
+    uint32_t value;
+    __asm__ volatile ("mov %%cr2, %0" : "=r"(value));
+    return value;
+}
+
+/* Stack and heap pages are only reserved by the process; back them on first touch */
+static int page_fault_demand(process_t* proc, uint32_t addr) {
+    int in_stack = addr >= proc->stack_base && addr < proc->stack_base + USER_STACK_SIZE;
+    int in_heap = addr >= proc->heap_start && addr < proc->heap_end;
+    if (!in_stack && !in_heap) return 0;
+    
+    uint32_t frame = alloc_zeroed_page();
+    if (!frame) return 0;
+    
+    /* Without a page table the fault would only repeat; let the task die */
+    if (!map_page(addr & ~(PAGE_SIZE - 1), frame, PAGE_PRESENT | PAGE_WRITE | PAGE_USER)) {
+        free_page(frame);
+        return 0;
+    }
+    proc->minor_faults++;
+    return 1;
+}
+
+/* Write to a page shared by fork: copy it unless this is the last sharer */
+static int page_fault_cow(process_t* proc, uint32_t addr) {
+    page_table_entry_t* entry = get_page_entry(NULL, addr, 0);
+    if (!entry || !entry->present || !(entry->available & 1)) return 0;
+    
+    uint32_t page = addr & ~(PAGE_SIZE - 1);
+    uint32_t frame = entry->address << 12;
+    page_t* desc = phys_to_page(frame);
+    
+    if (desc && desc->refcount <= 1) {
+        map_page(page, frame, PAGE_PRESENT | PAGE_WRITE | PAGE_USER);
+    } else {
+        uint32_t copy = alloc_page();
+        if (!copy) return 0;
+        
+        memcpy(PHYS_TO_VIRT(copy), PHYS_TO_VIRT(frame), PAGE_SIZE);
+        map_page(page, copy, PAGE_PRESENT | PAGE_WRITE | PAGE_USER);
+        page_unref(frame);
+    }
+    
+    proc->minor_faults++;
+    return 1;
+}
+
+static void page_fault_handler(registers_t* regs) {
+    uint32_t addr = read_cr2();
+    process_t* proc = process_get_current();
+    
+    /* Kernel threads have no user address space to populate */
+    if (proc && proc->page_directory == VIRT_TO_PHYS(kernel_page_directory())) {
+        proc = NULL;
+    }
+    
+    if (!(regs->err_code & PF_PRESENT) && proc && addr < KERNEL_VIRTUAL_BASE) {
+        if (page_fault_demand(proc, addr)) return;
+    }
+    if ((regs->err_code & (PF_PRESENT | PF_WRITE)) == (PF_PRESENT | PF_WRITE) &&
+        proc && addr < KERNEL_VIRTUAL_BASE) {
+        if (page_fault_cow(proc, addr)) return;
+    }
+    
+    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_RED);
+    vga_printf("Page fault at 0x%x (%s, %s, %s mode) EIP: 0x%x\n", addr,
+               (regs->err_code & PF_PRESENT) ? "protection" : "not present",
+               (regs->err_code & PF_WRITE) ? "write" : "read",
+               (regs->err_code & PF_USER) ? "user" : "kernel",
+               regs->eip);
+    
+    /* A user task only takes itself down, the vDSO pages included */
+    if (regs->err_code & PF_USER) {
+        vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+        process_exit(EXIT_FAULT + 14);
+    }
+    kernel_panic("Unhandled page fault");
+}
+
+void page_fault_init(void) {
+    exception_install_handler(14, page_fault_handler);
+}
\ No newline at end of file
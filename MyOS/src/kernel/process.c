@@ -1,118 +1,777 @@
 #include "process.h"
 #include "kernel.h"
 #include "vga.h"
+#include "memory.h"
+#include "cpu.h"
+#include "tss.h"
+#include "serial.h"
+#include "fpu.h"
+#include "cmdline.h"
+#include "smp.h"
+#include "vdso.h"
+#include "syscall.h"
 
-static process_t processes[MAX_PROCESSES];
-static process_t* current_process = NULL;
-static process_t* ready_queue = NULL;
-static uint32_t next_pid = 1;
+/* The task running on this CPU */
+#define current_process (this_cpu()->current)
+
+static process_t* zombie_process = NULL;   /* Exited, freed once off its stack */
+static process_t* task_list = NULL;        /* Every live process */
 static uint32_t process_count = 0;
 
+/* PCBs are kmalloc'd and found through a PID hash; PIDs come from a bitmap,
+ * handed out in increasing order so a freed PID is not reused straight away */
+#define PID_WORDS (PID_MAX / 32)
+#define PID_HASH_SIZE (1 << PID_HASH_BITS)
+
+static uint32_t pid_bitmap[PID_WORDS] = {1}; /* PID 0 is never allocated */
+static uint32_t pid_last = 0;
+static process_t* pid_hash[PID_HASH_SIZE];
+
 /* Timer for scheduling */
 static uint32_t timer_ticks = 0;
 static uint32_t time_slice_ticks = 10; /* 10 timer ticks per time slice */
 
+/* Sleep accuracy, measured from the deadline to the sleeper running again */
+static uint32_t sleep_count = 0;
+static uint32_t sleep_late_ticks = 0;
+static uint32_t sleep_late_max = 0;
+
+/* switch_to() relies on these offsets */
+_Static_assert(__builtin_offsetof(process_t, esp) == 40, "switch.asm PROCESS_ESP");
+_Static_assert(__builtin_offsetof(process_t, eip) == 48, "switch.asm PROCESS_EIP");
+
+/* Per-CPU, per-priority FIFO run queues of READY tasks; the running task is
+ * not queued. Bit n of map is set while level n is non-empty. A CPU that
+ * runs out of work steals from the one with the most queued. */
+typedef struct run_queue {
+    process_t* head;
+    process_t* tail;
+} run_queue_t;
+
+typedef struct cpu_run_queue {
+    run_queue_t levels[SCHED_PRIORITIES];
+    uint32_t map;
+    uint32_t nr_queued;         /* Excluding the idle task */
+    uint32_t nr_stealable;      /* Queued tasks that may migrate */
+    uint32_t steals;            /* Tasks this CPU took from others */
+} cpu_run_queue_t;
+
+static cpu_run_queue_t run_queues[MAX_CPUS];
+
+static void process_reap(void);
+static process_t* process_spawn(const char* name, void (*entry_point)(void),
+                                uint32_t priority, page_directory_t* directory);
+
+/* Scheduling policy, chosen at boot: per-priority queues or sched=cfs.
+ * The idle tasks stay outside the fair tree and run when it has nothing. */
+static int sched_fair = 0;
+
+static inline int process_stealable(process_t* proc) {
+    return !(proc->flags & (PROCESS_IDLE | PROCESS_PINNED));
+}
+
+static void prio_queue_add(process_t* proc) {
+    cpu_run_queue_t* rq = &run_queues[proc->cpu];
+    run_queue_t* queue = &rq->levels[proc->priority];
+    proc->next = NULL;
+    proc->prev = queue->tail;
+    if (queue->tail) queue->tail->next = proc;
+    else queue->head = proc;
+    queue->tail = proc;
+    rq->map |= 1 << proc->priority;
+    if (!(proc->flags & PROCESS_IDLE)) rq->nr_queued++;
+    if (process_stealable(proc)) rq->nr_stealable++;
+}
+
+static void prio_queue_remove(process_t* proc) {
+    cpu_run_queue_t* rq = &run_queues[proc->cpu];
+    run_queue_t* queue = &rq->levels[proc->priority];
+    if (proc->prev) proc->prev->next = proc->next;
+    else queue->head = proc->next;
+    if (proc->next) proc->next->prev = proc->prev;
+    else queue->tail = proc->prev;
+    proc->next = NULL;
+    proc->prev = NULL;
+    if (!queue->head) rq->map &= ~(1 << proc->priority);
+    if (!(proc->flags & PROCESS_IDLE)) rq->nr_queued--;
+    if (process_stealable(proc)) rq->nr_stealable--;
+}
+
+/* Highest non-empty level (bsr), oldest task first */
+static process_t* prio_queue_pick(cpu_run_queue_t* rq) {
+    if (!rq->map) return NULL;
+    process_t* proc = rq->levels[31 - __builtin_clz(rq->map)].head;
+    prio_queue_remove(proc);
+    return proc;
+}
+
+/* Take the highest priority task that may migrate from the CPU with the
+ * most of them queued */
+static process_t* prio_queue_steal(uint32_t cpu) {
+    cpu_run_queue_t* busiest = NULL;
+    for (uint32_t i = 0; i < smp_cpu_count; i++) {
+        if (i == cpu || !run_queues[i].nr_stealable) continue;
+        if (!busiest || run_queues[i].nr_stealable > busiest->nr_stealable) {
+            busiest = &run_queues[i];
+        }
+    }
+    if (!busiest) return NULL;
+    
+    for (uint32_t map = busiest->map; map; ) {
+        uint32_t level = 31 - __builtin_clz(map);
+        map &= ~(1u << level);
+        for (process_t* proc = busiest->levels[level].head; proc; proc = proc->next) {
+            if (!process_stealable(proc)) continue;
+            prio_queue_remove(proc);
+            proc->cpu = cpu;
+            run_queues[cpu].steals++;
+            return proc;
+        }
+    }
+    return NULL;
+}
+
+static void run_queue_add(process_t* proc) {
+    if (!sched_fair) prio_queue_add(proc);
+    else if (!(proc->flags & PROCESS_IDLE)) fair_enqueue(proc);
+}
+
+static void run_queue_remove(process_t* proc) {
+    if (!sched_fair) prio_queue_remove(proc);
+    else if (!(proc->flags & PROCESS_IDLE)) fair_dequeue(proc);
+}
+
+/* Own queue first; a CPU with only its idle task left looks for work
+ * elsewhere before settling for it */
+static process_t* run_queue_pick(void) {
+    cpu_t* cpu = this_cpu();
+    process_t* proc;
+    
+    if (sched_fair) {
+        proc = fair_pick(cpu->id);
+        if (!proc && cpu->idle && cpu->idle->state == PROCESS_READY) proc = cpu->idle;
+        return proc;
+    }
+    
+    cpu_run_queue_t* rq = &run_queues[cpu->id];
+    if (!rq->nr_queued && smp_active) {
+        proc = prio_queue_steal(cpu->id);
+        if (proc) return proc;
+    }
+    return prio_queue_pick(rq);
+}
+
+/* Least loaded online CPU for a new task, counting what it is running */
+static uint32_t run_queue_select_cpu(process_t* proc) {
+    uint32_t self = this_cpu()->id;
+    if (!smp_active || (proc->flags & PROCESS_PINNED)) return self;
+    
+    uint32_t best = self;
+    uint32_t best_load = ~0u;
+    for (uint32_t i = 0; i < smp_cpu_count; i++) {
+        if (!cpus[i].online) continue;
+        uint32_t load = run_queues[i].nr_queued + (cpus[i].current != cpus[i].idle);
+        if (load < best_load) {
+            best = i;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+/* A task became runnable: wake a halted CPU that can take it, its own or
+ * any idle one that is allowed to steal it */
+static void run_queue_kick(process_t* proc) {
+    if (!smp_active) return;
+    
+    uint32_t self = this_cpu()->id;
+    for (uint32_t i = 0; i < smp_cpu_count; i++) {
+        cpu_t* cpu = &cpus[i];
+        if (i == self || !cpu->online || cpu->current != cpu->idle) continue;
+        if (i == proc->cpu || process_stealable(proc)) {
+            smp_send_reschedule(i);
+            return;
+        }
+    }
+}
+
+/* Next free PID after the last one handed out, 0 when all are in use */
+static uint32_t pid_alloc(void) {
+    uint32_t start = pid_last + 1 < PID_MAX ? pid_last + 1 : 1;
+    uint32_t word = start / 32;
+    uint32_t free = ~pid_bitmap[word] & (~0u << (start & 31));
+    
+    for (uint32_t n = 0; n <= PID_WORDS; n++) {
+        if (free) {
+            uint32_t pid = word * 32 + __builtin_ctz(free);
+            pid_bitmap[word] |= 1u << (pid & 31);
+            pid_last = pid;
+            return pid;
+        }
+        word = (word + 1) % PID_WORDS;
+        free = ~pid_bitmap[word];
+    }
+    return 0;
+}
+
+static void pid_free(uint32_t pid) {
+    pid_bitmap[pid / 32] &= ~(1u << (pid & 31));
+}
+
+static inline uint32_t pid_hash_index(uint32_t pid) {
+    return (pid * 2654435761u) >> (32 - PID_HASH_BITS);
+}
+
+/* Freed kernel stacks stay mapped and are reused, so process churn does not
+ * walk the vmalloc area list. Each one is chained through its first word. */
+#define STACK_CACHE_MAX 64
+
+static void* stack_cache = NULL;
+static uint32_t stack_cache_count = 0;
+
+static uint32_t kernel_stack_alloc(void) {
+    if (stack_cache) {
+        void* stack = stack_cache;
+        stack_cache = *(void**)stack;
+        stack_cache_count--;
+        return (uint32_t)stack;
+    }
+    
+    /* vmalloc leaves unmapped pages around the stack, an overflow faults
+     * instead of running into the neighbouring allocation */
+    return (uint32_t)vmalloc(STACK_SIZE);
+}
+
+static void kernel_stack_free(uint32_t stack) {
+    if (stack_cache_count < STACK_CACHE_MAX) {
+        *(void**)stack = stack_cache;
+        stack_cache = (void*)stack;
+        stack_cache_count++;
+    } else {
+        vfree((void*)stack);
+    }
+}
+
+/* Give a new PCB a PID and make it visible to lookups and process_list() */
+static int process_register(process_t* proc) {
+    uint32_t pid = pid_alloc();
+    if (!pid) return 0;
+    
+    proc->pid = pid;
+    uint32_t index = pid_hash_index(pid);
+    proc->hash_next = pid_hash[index];
+    pid_hash[index] = proc;
+    
+    proc->task_prev = NULL;
+    proc->task_next = task_list;
+    if (task_list) task_list->task_prev = proc;
+    task_list = proc;
+    
+    process_count++;
+    return 1;
+}
+
+static void process_unregister(process_t* proc) {
+    process_t** link = &pid_hash[pid_hash_index(proc->pid)];
+    while (*link != proc) link = &(*link)->hash_next;
+    *link = proc->hash_next;
+    
+    if (proc->task_prev) proc->task_prev->task_next = proc->task_next;
+    else task_list = proc->task_next;
+    if (proc->task_next) proc->task_next->task_prev = proc->task_prev;
+    
+    pid_free(proc->pid);
+    process_count--;
+}
+
 void process_init(void) {
-    /* Initialize process table */
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        processes[i].pid = 0;
-        processes[i].state = PROCESS_TERMINATED;
-        processes[i].next = NULL;
+    /* sched=cfs orders tasks by weighted CPU time instead of strict priority */
+    const char* policy = cmdline_get("sched");
+    if (policy && (strcmp(policy, "cfs") == 0 || strcmp(policy, "fair") == 0)) {
+        sched_fair = 1;
     }
     
-    /* Create kernel idle process */
-    process_create("idle", idle_process, 0);
+    /* The boot thread carries on as the kernel process, on the boot stack */
+    process_t* kernel = kmalloc(sizeof(process_t));
+    if (!kernel) kernel_panic("No memory for the kernel process");
+    memset(kernel, 0, sizeof(process_t));
+    strcpy(kernel->name, "kernel");
+    kernel->state = PROCESS_RUNNING;
+    kernel->priority = 1;
+    kernel->base_priority = 1;
+    kernel->time_slice = time_slice_ticks;
+    kernel->page_directory = VIRT_TO_PHYS(kernel_page_directory());
+    /* The shell borrows address spaces and owns the console, keep it here */
+    kernel->flags = PROCESS_PINNED;
+    kernel->cpu = this_cpu()->id;
+    process_register(kernel);
+    current_process = kernel;
+    
+    /* Create kernel idle process. The fair policy keeps it off the tree, so
+     * it is requeued once it is known to be the idle task. */
+    uint32_t flags = irq_save();
+    process_t* idle = process_spawn("idle", idle_process, 0, kernel_page_directory());
+    if (!idle) kernel_panic("Cannot create the idle process");
+    run_queue_remove(idle);
+    idle->flags = PROCESS_IDLE | PROCESS_PINNED;
+    this_cpu()->idle = idle;
+    run_queue_add(idle);
+    irq_restore(flags);
     
     vga_puts("Process management initialized\n");
 }
 
-uint32_t process_create(const char* name, void (*entry_point)(void), uint32_t priority) {
-    if (process_count >= MAX_PROCESSES) {
-        return 0; /* No free process slots */
-    }
+/* An AP's boot thread becomes its idle task, the way the BSP's carries on
+ * as the kernel process. Runs on the new CPU with interrupts off. */
+void process_init_cpu(uint32_t kernel_stack) {
+    cpu_t* cpu = this_cpu();
+    process_t* idle = kmalloc(sizeof(process_t));
+    if (!idle) kernel_panic("No memory for an idle process");
+    memset(idle, 0, sizeof(process_t));
+    strcpy(idle->name, "idle/");
+    idle->name[5] = '0' + cpu->id;
+    idle->state = PROCESS_RUNNING;
+    idle->time_slice = time_slice_ticks;
+    idle->page_directory = VIRT_TO_PHYS(kernel_page_directory());
+    idle->kernel_stack = kernel_stack;
+    idle->flags = PROCESS_IDLE | PROCESS_PINNED;
+    idle->cpu = cpu->id;
     
-    /* Find free process slot */
-    process_t* proc = NULL;
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (processes[i].state == PROCESS_TERMINATED) {
-            proc = &processes[i];
-            break;
+    uint32_t flags = irq_save();
+    fair_task_init(idle);
+    if (!process_register(idle)) kernel_panic("No PID for an idle process");
+    irq_restore(flags);
+    
+    cpu->idle = idle;
+    cpu->current = idle;
+}
+
+/* First code a new process runs, entered from switch_to() with the entry
+ * point as its argument. The switch happened under the big kernel lock,
+ * which the new task does not hold in any frame of its own. */
+static void process_start(void (*entry_point)(void)) {
+    process_reap();
+    bkl_drop();
+    __asm__ volatile ("sti");
+    entry_point();
+    process_exit(0);
+}
+
+static process_t* process_spawn(const char* name, void (*entry_point)(void),
+                                uint32_t priority, page_directory_t* directory) {
+    process_t* proc = kmalloc(sizeof(process_t));
+    if (!proc) return NULL;
+    memset(proc, 0, sizeof(process_t));
+    
+    /* Processes get their own address space unless one is given */
+    page_directory_t* owned = NULL;
+    if (!directory) {
+        owned = create_page_directory();
+        if (!owned) {
+            kfree(proc);
+            return NULL;
         }
+        directory = owned;
+    }
+    
+    /* Another address space is only ever loaded on the CPU it starts on */
+    if (owned) proc->flags = PROCESS_PINNED;
+    
+    uint32_t kernel_stack = kernel_stack_alloc();
+    if (!kernel_stack || !process_register(proc)) {
+        if (kernel_stack) kernel_stack_free(kernel_stack);
+        if (owned) free_page(VIRT_TO_PHYS(owned));
+        kfree(proc);
+        return NULL;
     }
     
-    if (!proc) return 0;
+    /* User address spaces see the clock and their PID without a trap */
+    if (owned && !vdso_map(owned, proc->pid)) {
+        process_unregister(proc);
+        kernel_stack_free(kernel_stack);
+        free_page_directory(owned);
+        kfree(proc);
+        return NULL;
+    }
     
     /* Initialize process */
-    proc->pid = next_pid++;
     strncpy(proc->name, name, PROCESS_NAME_LEN - 1);
     proc->name[PROCESS_NAME_LEN - 1] = '\0';
     proc->state = PROCESS_READY;
-    proc->priority = priority;
+    proc->priority = priority < SCHED_PRIORITIES ? priority : SCHED_PRIORITIES - 1;
+    proc->base_priority = proc->priority;
     proc->time_slice = time_slice_ticks;
     proc->total_time = 0;
     
-    /* Allocate stack */
-    proc->stack_base = 0x200000 + (proc->pid * STACK_SIZE); /* Simple stack allocation */
-    proc->esp = proc->stack_base + STACK_SIZE - 4;
-    proc->ebp = proc->esp;
-    proc->eip = (uint32_t)entry_point;
+    proc->minor_faults = 0;
+    proc->sleep_timer.slot = NULL;
+    proc->fpu_state = NULL;
+    fair_task_init(proc);
+    proc->page_directory = VIRT_TO_PHYS(directory);
     
-    /* Initialize heap */
-    proc->heap_start = proc->stack_base + STACK_SIZE;
-    proc->heap_end = proc->heap_start;
+    /* The first switch_to() lands in process_start(entry_point) */
+    proc->kernel_stack = kernel_stack;
+    uint32_t* stack = (uint32_t*)(proc->kernel_stack + STACK_SIZE);
+    *--stack = (uint32_t)entry_point;
+    *--stack = 0;   /* process_start never returns */
+    proc->esp = (uint32_t)stack;
+    proc->ebp = 0;
+    proc->eip = (uint32_t)process_start;
     
-    /* Add to ready queue */
-    proc->next = ready_queue;
-    ready_queue = proc;
+    /* User stack and heap are only reserved, the page fault handler backs them */
+    proc->stack_base = USER_STACK_TOP - USER_STACK_SIZE;
+    proc->heap_start = USER_HEAP_START;
+    proc->heap_end = proc->heap_start;
     
-    process_count++;
+    proc->cpu = run_queue_select_cpu(proc);
+    run_queue_add(proc);
+    run_queue_kick(proc);
     
     vga_printf("Created process '%s' (PID: %d)\n", name, proc->pid);
-    return proc->pid;
+    return proc;
 }
 
-void process_exit(uint32_t exit_code) {
-    if (!current_process) return;
+uint32_t process_create(const char* name, void (*entry_point)(void), uint32_t priority) {
+    uint32_t flags = irq_save();
+    process_t* proc = process_spawn(name, entry_point, priority, NULL);
+    irq_restore(flags);
+    return proc ? proc->pid : 0;
+}
+
+/* Kernel threads run in the kernel directory and never need a CR3 reload */
+uint32_t kthread_create(const char* name, void (*entry_point)(void), uint32_t priority) {
+    uint32_t flags = irq_save();
+    process_t* proc = process_spawn(name, entry_point, priority, kernel_page_directory());
+    irq_restore(flags);
+    return proc ? proc->pid : 0;
+}
+
+/* Keep a task on the calling CPU from now on */
+void process_pin(process_t* proc) {
+    uint32_t flags = irq_save();
+    int queued = proc->state == PROCESS_READY && proc != current_process;
+    if (queued) run_queue_remove(proc);
+    proc->flags |= PROCESS_PINNED;
+    proc->cpu = this_cpu()->id;
+    if (queued) run_queue_add(proc);
+    irq_restore(flags);
+}
+
+/* Change the priority a task is scheduled at, requeueing it if it is
+ * waiting for a CPU */
+void process_set_priority(process_t* proc, uint32_t priority) {
+    if (priority >= SCHED_PRIORITIES) priority = SCHED_PRIORITIES - 1;
     
-    vga_printf("Process '%s' (PID: %d) exiting with code %d\n", 
-               current_process->name, current_process->pid, exit_code);
+    uint32_t flags = irq_save();
+    int queued = proc->state == PROCESS_READY && proc != current_process;
+    if (queued) run_queue_remove(proc);
+    proc->priority = priority;
+    if (queued) run_queue_add(proc);
+    irq_restore(flags);
+}
+
+/* Take a task off the run queue if it is waiting there */
+static void process_unlink(process_t* proc) {
+    if (proc->state == PROCESS_READY && proc != current_process) {
+        run_queue_remove(proc);
+    }
+}
+
+/* Park a task that is not running; only process_wake() makes it runnable */
+static void process_park(process_t* proc) {
+    process_unlink(proc);
+    proc->state = PROCESS_BLOCKED;
+}
+
+/* Tear down a process that is not running: its address space, kernel stack,
+ * PID and PCB. The caller must not have its directory loaded. */
+static void process_release(process_t* proc) {
+    process_unlink(proc);
+    timer_event_cancel(&proc->sleep_timer);
+    fpu_release(proc);
+    free_page_directory(PHYS_TO_VIRT(proc->page_directory));
+    if (proc->kernel_stack) {
+        kernel_stack_free(proc->kernel_stack);
+    }
+    process_unregister(proc);
+    proc->state = PROCESS_TERMINATED;
+    kfree(proc);
+}
+
+/* Free the last exited process once another one is running */
+static void process_reap(void) {
+    if (zombie_process && zombie_process != current_process) {
+        process_release(zombie_process);
+        zombie_process = NULL;
+    }
+}
+
+/* Duplicate the current process: a new PCB and an address space sharing
+ * every user frame copy-on-write. The child is registered but parked, with
+ * an empty kernel stack; the caller decides how it starts. */
+static process_t* process_clone(void) {
+    if (!current_process) return NULL;
+    if (!current_process->kernel_stack) return NULL; /* Boot thread */
     
-    current_process->state = PROCESS_TERMINATED;
-    process_count--;
+    process_t* child = kmalloc(sizeof(process_t));
+    if (!child) return NULL;
     
-    /* Remove from ready queue if present */
-    if (ready_queue == current_process) {
-        ready_queue = current_process->next;
-    } else {
-        process_t* prev = ready_queue;
-        while (prev && prev->next != current_process) {
-            prev = prev->next;
+    uint32_t kernel_stack = kernel_stack_alloc();
+    if (!kernel_stack) {
+        kfree(child);
+        return NULL;
+    }
+    
+    page_directory_t* directory = clone_page_directory();
+    if (!directory) {
+        kernel_stack_free(kernel_stack);
+        kfree(child);
+        return NULL;
+    }
+    
+    *child = *current_process;
+    if (!process_register(child)) {
+        free_page_directory(directory);
+        kernel_stack_free(kernel_stack);
+        kfree(child);
+        return NULL;
+    }
+    
+    /* The clone shares the parent's task page, the child needs its own */
+    if (!vdso_map(directory, child->pid)) {
+        process_unregister(child);
+        free_page_directory(directory);
+        kernel_stack_free(kernel_stack);
+        kfree(child);
+        return NULL;
+    }
+    child->state = PROCESS_BLOCKED;
+    child->time_slice = time_slice_ticks;
+    child->total_time = 0;
+    child->minor_faults = 0;
+    child->sleep_timer.slot = NULL;
+    /* Locks and lent priority stay with the parent */
+    child->priority = child->base_priority;
+    child->wait_next = NULL;
+    child->waiting_on = NULL;
+    child->blocked_on = NULL;
+    child->held_mutexes = NULL;
+    fpu_fork(current_process, child);
+    child->page_directory = VIRT_TO_PHYS(directory);
+    
+    child->kernel_stack = kernel_stack;
+    child->esp = 0;
+    child->ebp = 0;
+    child->eip = 0;
+    child->next = NULL;
+    child->prev = NULL;
+    
+    return child;
+}
+
+/* First code a forked child runs, entered from switch_to() like
+ * process_start(). It leaves for user mode through its copy of the parent's
+ * system call frame, with fork() returning 0. */
+static void process_fork_start(syscall_frame_t* frame) {
+    process_reap();
+    bkl_drop();
+    syscall_return(frame, 0);
+}
+
+/* fork(): the child resumes in user mode where the parent made the call */
+uint32_t process_fork(const syscall_frame_t* frame) {
+    uint32_t flags = irq_save();
+    process_t* child = process_clone();
+    if (!child) {
+        irq_restore(flags);
+        return (uint32_t)-1;
+    }
+    
+    /* The copy sits at the top of the child's kernel stack, where its own
+     * entries from user mode will start as well */
+    syscall_frame_t* child_frame = (syscall_frame_t*)(child->kernel_stack + STACK_SIZE) - 1;
+    *child_frame = *frame;
+    uint32_t* stack = (uint32_t*)child_frame;
+    *--stack = (uint32_t)child_frame;
+    *--stack = 0;   /* process_fork_start never returns */
+    child->esp = (uint32_t)stack;
+    child->ebp = 0;
+    child->eip = (uint32_t)process_fork_start;
+    
+    uint32_t pid = child->pid;
+    process_wake(child);
+    irq_restore(flags);
+    return pid;
+}
+
+/* Fork latency against the parent's resident set. A scratch process is made
+ * current, its heap populated to each size in turn and then cloned; the
+ * children never run. */
+void process_fork_benchmark(void) {
+    static const uint32_t resident_pages[] = {0, 16, 64, 256, 1024};
+    
+    /* Keep the scheduler away while the scratch process is borrowed */
+    uint32_t flags = irq_save();
+    process_t* parent = process_spawn("forkbench", idle_process, 0, NULL);
+    if (!parent) {
+        irq_restore(flags);
+        vga_puts("forkbench: out of processes\n");
+        return;
+    }
+    process_park(parent);
+    process_t* saved_process = current_process;
+    page_directory_t* saved_directory = current_page_directory();
+    current_process = parent;
+    switch_page_directory(PHYS_TO_VIRT(parent->page_directory));
+    
+    vga_puts("Pages  Fork cycles  Cycles/page\n");
+    uint32_t resident = 0;
+    for (uint32_t i = 0; i < sizeof(resident_pages) / sizeof(resident_pages[0]); i++) {
+        /* Touch the new heap pages so they are really resident */
+        uint32_t grow = resident_pages[i] - resident;
+        uint8_t* heap = (uint8_t*)process_sbrk(grow * PAGE_SIZE);
+        if (heap == (uint8_t*)-1) break;
+        for (uint32_t j = 0; j < grow; j++) {
+            heap[j * PAGE_SIZE] = (uint8_t)j;
         }
-        if (prev) {
-            prev->next = current_process->next;
+        resident = resident_pages[i];
+        
+        uint64_t start = rdtsc();
+        process_t* child = process_clone();
+        uint32_t cycles = (uint32_t)(rdtsc() - start);
+        
+        if (!child) {
+            vga_puts("forkbench: fork failed\n");
+            break;
         }
+        process_release(child);
+        
+        vga_printf("%-5d  %-11u  %u\n", resident, cycles,
+                   resident ? cycles / resident : cycles);
     }
     
-    current_process = NULL;
+    current_process = saved_process;
+    switch_page_directory(saved_directory);
+    process_release(parent);
+    irq_restore(flags);
+}
+
+void process_exit(uint32_t exit_code) {
+    if (!current_process) return;
+    
+    vga_printf("Process '%s' (PID: %d) exiting with code %d\n", 
+               current_process->name, current_process->pid, exit_code);
+    
+    /* The stack we are running on is freed by whoever runs next. The lock
+     * is held across the switch, so nobody reaps it before we are off it. */
+    irq_save();
+    process_reap();
+    current_process->state = PROCESS_ZOMBIE;
+    zombie_process = current_process;
+    
     schedule(); /* Switch to next process */
+    
+    /* Nothing else was runnable */
+    while (1) {
+        __asm__ volatile ("hlt");
+    }
 }
 
 void process_yield(void) {
     if (!current_process) return;
     
+    uint32_t flags = irq_save();
     current_process->state = PROCESS_READY;
     schedule();
+    irq_restore(flags);
 }
 
-void process_sleep(uint32_t ms) {
+/* Stop running until someone calls process_wake() */
+void process_block(void) {
     if (!current_process) return;
     
-    /* Simple sleep implementation - just yield for now */
-    /* In a real OS, this would block the process for the specified time */
-    uint32_t sleep_ticks = ms / 10; /* Approximate */
-    for (uint32_t i = 0; i < sleep_ticks; i++) {
+    uint32_t flags = irq_save();
+    current_process->state = PROCESS_BLOCKED;
+    schedule();
+    irq_restore(flags);
+}
+
+void process_wake(process_t* proc) {
+    uint32_t flags = irq_save();
+    if (proc->state == PROCESS_BLOCKED) {
+        proc->state = PROCESS_READY;
+        run_queue_add(proc);
+        run_queue_kick(proc);
+    }
+    irq_restore(flags);
+}
+
+static void process_sleep_expired(void* data) {
+    process_wake((process_t*)data);
+}
+
+/* Block on the timer wheel until the deadline passes; the idle task runs
+ * while nothing else is ready */
+void process_sleep(uint32_t ms) {
+    if (!current_process) return;
+    if (ms == 0) {
         process_yield();
+        return;
     }
+    
+    uint32_t ticks = (ms * TIMER_FREQUENCY + 999) / 1000;
+    uint32_t flags = irq_save();
+    uint32_t deadline = timer_get_ticks() + ticks;
+    
+    current_process->sleep_timer.callback = process_sleep_expired;
+    current_process->sleep_timer.data = current_process;
+    timer_event_add(&current_process->sleep_timer, deadline);
+    process_block();
+    
+    /* Wake-up accuracy as seen by the sleeper, including run queue delay */
+    uint32_t late = timer_get_ticks() - deadline;
+    sleep_count++;
+    sleep_late_ticks += late;
+    if (late > sleep_late_max) sleep_late_max = late;
+    irq_restore(flags);
+}
+
+void process_sleep_info(void) {
+    vga_printf("Sleeps:      %u (wake-up lateness avg %u, max %u ticks)\n", sleep_count,
+               sleep_count ? sleep_late_ticks / sleep_count : 0, sleep_late_max);
+}
+
+/* Move the heap break. Growing only reserves address space; shrinking hands
+ * back the frames of any pages that were touched. Returns the old break. */
+uint32_t process_sbrk(int32_t increment) {
+    if (!current_process) return (uint32_t)-1;
+    
+    uint32_t old_end = current_process->heap_end;
+    uint32_t new_end = old_end + increment;
+    if (increment > 0 && (new_end < old_end ||
+        new_end - current_process->heap_start > USER_HEAP_MAX_SIZE)) {
+        return (uint32_t)-1;
+    }
+    if (increment < 0 && (new_end > old_end || new_end < current_process->heap_start)) {
+        return (uint32_t)-1;
+    }
+    
+    if (increment < 0) {
+        /* The caller's address space is the loaded one */
+        uint32_t first = (new_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+        uint32_t last = (old_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+        
+        for (uint32_t addr = first; addr < last; addr += PAGE_SIZE) {
+            page_table_entry_t* entry = get_page_entry(NULL, addr, 0);
+            if (entry && entry->present) {
+                page_unref(entry->address << 12);
+            }
+        }
+        if (first < last) unmap_range(first, (last - first) / PAGE_SIZE);
+    }
+    
+    current_process->heap_end = new_end;
+    return old_end;
 }
 
 process_t* process_get_current(void) {
@@ -120,10 +779,8 @@ process_t* process_get_current(void) {
 }
 
 process_t* process_get_by_pid(uint32_t pid) {
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (processes[i].pid == pid && processes[i].state != PROCESS_TERMINATED) {
-            return &processes[i];
-        }
+    for (process_t* proc = pid_hash[pid_hash_index(pid)]; proc; proc = proc->hash_next) {
+        if (proc->pid == pid) return proc;
     }
     return NULL;
 }
@@ -131,27 +788,32 @@ process_t* process_get_by_pid(uint32_t pid) {
 void process_list(void) {
     vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
     vga_puts("Process List:\n");
-    vga_puts("PID  Name           State    Priority  CPU Time\n");
-    vga_puts("---  ----           -----    --------  --------\n");
-    
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (processes[i].state != PROCESS_TERMINATED) {
-            const char* state_str;
-            switch (processes[i].state) {
-                case PROCESS_READY: state_str = "READY"; break;
-                case PROCESS_RUNNING: state_str = "RUNNING"; break;
-                case PROCESS_BLOCKED: state_str = "BLOCKED"; break;
-                default: state_str = "UNKNOWN"; break;
-            }
-            
-            vga_printf("%-3d  %-13s  %-7s  %-8d  %d\n",
-                       processes[i].pid,
-                       processes[i].name,
-                       state_str,
-                       processes[i].priority,
-                       processes[i].total_time);
+    vga_puts("PID  Name           State    Priority  CPU Time  Faults  CPU\n");
+    vga_puts("---  ----           -----    --------  --------  ------  ---\n");
+    
+    uint32_t flags = irq_save();
+    for (process_t* proc = task_list; proc; proc = proc->task_next) {
+        const char* state_str;
+        switch (proc->state) {
+            case PROCESS_READY: state_str = "READY"; break;
+            case PROCESS_RUNNING: state_str = "RUNNING"; break;
+            case PROCESS_BLOCKED: state_str = "BLOCKED"; break;
+            case PROCESS_ZOMBIE: state_str = "ZOMBIE"; break;
+            default: state_str = "UNKNOWN"; break;
         }
+        
+        vga_printf("%-3d  %-13s  %-7s  %-8d  %-8d  %-6d  %d\n",
+                   proc->pid,
+                   proc->name,
+                   state_str,
+                   proc->priority,
+                   proc->total_time,
+                   proc->minor_faults,
+                   proc->cpu);
     }
+    irq_restore(flags);
+    vga_printf("%u processes\n", process_count);
+    if (sched_fair) fair_info();
     vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
 }
 
@@ -160,94 +822,205 @@ void scheduler_init(void) {
     vga_puts("Scheduler initialized\n");
 }
 
-void scheduler_tick(void) {
-    timer_ticks++;
+/* Charge the task running on this CPU. ticks is more than one when the
+ * timer caught up after a tickless idle. */
+void scheduler_tick(uint32_t ticks) {
+    uint32_t flags = irq_save();
+    cpu_t* cpu = this_cpu();
+    process_t* curr = cpu->current;
+    if (cpu->id == 0) timer_ticks += ticks;
+    cpu->ticks += ticks;
     
-    if (current_process) {
-        current_process->total_time++;
-        current_process->time_slice--;
+    if (curr) {
+        curr->total_time += ticks;
+        if (curr->flags & PROCESS_IDLE) cpu->idle_ticks += ticks;
+        else if (sched_fair) fair_account(curr, ticks);
         
-        /* Time slice expired? */
-        if (current_process->time_slice == 0) {
-            current_process->time_slice = time_slice_ticks;
-            if (current_process->state == PROCESS_RUNNING) {
-                current_process->state = PROCESS_READY;
-            }
-            schedule();
+        /* Time slice expired? The switch happens on interrupt exit */
+        if (curr->time_slice <= ticks) {
+            curr->time_slice = time_slice_ticks;
+            cpu->need_resched = 1;
+        } else {
+            curr->time_slice -= ticks;
         }
     }
+    irq_restore(flags);
 }
 
+/* Preemption point, called on interrupt exit once the bottom halves ran */
+void scheduler_preempt(void) {
+    if (!this_cpu()->need_resched) return;
+    
+    uint32_t flags = irq_save();
+    if (current_process && current_process->state == PROCESS_RUNNING) {
+        current_process->state = PROCESS_READY;
+    }
+    schedule();
+    irq_restore(flags);
+}
+
+/* Whether any task besides the running one is waiting for this CPU, or
+ * could be stolen from another */
+int scheduler_runnable(void) {
+    uint32_t cpu = this_cpu()->id;
+    if (sched_fair) return fair_runnable(cpu);
+    if (run_queues[cpu].map) return 1;
+    
+    for (uint32_t i = 0; i < smp_cpu_count; i++) {
+        if (i != cpu && run_queues[i].nr_stealable) return 1;
+    }
+    return 0;
+}
+
+/* A running task that is still READY is queued again, then the policy picks:
+ * O(1) for the priority levels, O(log n) for the fair tree */
 void schedule(void) {
-    process_t* next = NULL;
-    process_t* highest_priority = NULL;
-    uint32_t max_priority = 0;
-    
-    /* Simple priority-based round-robin scheduler */
-    process_t* proc = ready_queue;
-    while (proc) {
-        if (proc->state == PROCESS_READY && proc->priority >= max_priority) {
-            max_priority = proc->priority;
-            highest_priority = proc;
-        }
-        proc = proc->next;
+    uint32_t flags = irq_save();
+    process_t* prev = current_process;
+    
+    if (prev && prev->state == PROCESS_READY) {
+        run_queue_add(prev);
     }
     
-    next = highest_priority;
+    this_cpu()->need_resched = 0;
+    process_t* next = run_queue_pick();
+    if (!next) {
+        /* Nothing runnable, carry on with the current task */
+        irq_restore(flags);
+        return;
+    }
     
-    if (next && next != current_process) {
-        process_t* prev = current_process;
-        current_process = next;
-        current_process->state = PROCESS_RUNNING;
-        current_process->time_slice = time_slice_ticks;
-        
-        if (prev) {
-            context_switch(next);
-        }
+    current_process = next;
+    next->cpu = this_cpu()->id;
+    next->state = PROCESS_RUNNING;
+    next->time_slice = sched_fair ? fair_timeslice(next) : time_slice_ticks;
+    
+    if (prev && next != prev) {
+        context_switch(prev, next);
+        /* Running again, possibly much later */
+        process_reap();
+    }
+    
+    irq_restore(flags);
+}
+
+/* Switch from prev to next. Kernel threads share the kernel directory, so
+ * CR3 is only reloaded when the address space really changes. The big
+ * kernel lock stays held across the switch; each task keeps its own
+ * nesting depth for when it runs again. */
+void context_switch(process_t* prev, process_t* next) {
+    if (next->page_directory != prev->page_directory) {
+        switch_page_directory(PHYS_TO_VIRT(next->page_directory));
+    }
+    
+    /* Interrupts from user mode arrive on the kernel stack of the new task */
+    if (next->kernel_stack) {
+        tss_set_kernel_stack(next->kernel_stack + STACK_SIZE);
     }
+    
+    fpu_switch(prev, next);
+    prev->lock_depth = this_cpu()->lock_depth;
+    switch_to(prev, next);
+    
+    /* prev is running again, maybe on another CPU */
+    this_cpu()->lock_depth = prev->lock_depth;
 }
 
-/* Simple context switch - in a real OS this would be in assembly */
-void context_switch(process_t* next) {
-    /* This is a simplified version - real context switching requires assembly */
-    /* For now, just update the current process pointer */
-    (void)next; /* Suppress unused parameter warning */
-    
-    /* In a real implementation, this would:
-     * 1. Save current process registers to its PCB
-     * 2. Load next process registers from its PCB
-     * 3. Switch page directory
-     * 4. Jump to next process
-     */
-}
-
-/* System call handler */
-uint32_t syscall_handler(uint32_t syscall_num, uint32_t arg1, uint32_t arg2, uint32_t arg3) {
-    switch (syscall_num) {
-        case SYS_EXIT:
-            process_exit(arg1);
-            return 0;
-            
-        case SYS_GETPID:
-            return current_process ? current_process->pid : 0;
-            
-        case SYS_SLEEP:
-            process_sleep(arg1);
-            return 0;
-            
-        case SYS_WRITE:
-            /* Simple write to console */
-            if (arg1 == 1) { /* stdout */
-                char* str = (char*)arg2;
-                for (uint32_t i = 0; i < arg3; i++) {
-                    vga_putchar(str[i]);
-                }
-                return arg3;
-            }
-            return -1;
-            
-        default:
-            return -1; /* Unknown system call */
+/* Context switch ping-pong benchmark */
+#define SWITCH_BENCH_ROUNDS 1000
+
+static uint32_t switch_samples[SWITCH_BENCH_ROUNDS * 2];
+static uint32_t switch_sample_count = 0;
+static volatile uint32_t switch_stamp = 0;
+static process_t* switch_bench_owner = NULL;
+static process_t* switch_bench_ping = NULL;
+static process_t* switch_bench_pong = NULL;
+
+/* Direct handoff that bypasses the scheduler; interrupts must be off */
+static void process_handoff(process_t* next) {
+    process_t* prev = current_process;
+    prev->state = PROCESS_BLOCKED;
+    next->state = PROCESS_RUNNING;
+    current_process = next;
+    context_switch(prev, next);
+}
+
+static void switch_bench_ping_main(void) {
+    __asm__ volatile ("cli");
+    
+    /* Warm up: the first switch into pong runs its startup path */
+    process_handoff(switch_bench_pong);
+    switch_sample_count = 0;
+    
+    for (uint32_t i = 0; i < SWITCH_BENCH_ROUNDS; i++) {
+        switch_stamp = (uint32_t)rdtsc();
+        process_handoff(switch_bench_pong);
+        switch_samples[switch_sample_count++] = (uint32_t)rdtsc() - switch_stamp;
     }
+    
+    process_handoff(switch_bench_owner);
 }
 
+/* The bench threads only ever run inside the owner's irq_save(), so unlike
+ * process_start() they keep the big kernel lock it handed over; the depth
+ * goes back to the owner through context_switch() */
+static void switch_bench_start(void (*entry_point)(void)) {
+    entry_point();
+}
+
+static void switch_bench_pong_main(void) {
+    __asm__ volatile ("cli");
+    
+    while (1) {
+        switch_samples[switch_sample_count++] = (uint32_t)rdtsc() - switch_stamp;
+        switch_stamp = (uint32_t)rdtsc();
+        process_handoff(switch_bench_ping);
+    }
+}
+
+/* Two kernel threads bounce the CPU back and forth. Each sample is one
+ * switch_to() from the TSC read before the switch to the one after it. */
+void process_switch_benchmark(void) {
+    uint32_t flags = irq_save();
+    
+    switch_bench_owner = current_process;
+    switch_bench_ping = process_spawn("ping", switch_bench_ping_main, 0, kernel_page_directory());
+    switch_bench_pong = process_spawn("pong", switch_bench_pong_main, 0, kernel_page_directory());
+    if (!switch_bench_owner || !switch_bench_ping || !switch_bench_pong) {
+        if (switch_bench_ping) process_release(switch_bench_ping);
+        if (switch_bench_pong) process_release(switch_bench_pong);
+        irq_restore(flags);
+        vga_puts("switchbench: cannot create threads\n");
+        return;
+    }
+    process_park(switch_bench_ping);
+    process_park(switch_bench_pong);
+    switch_bench_ping->eip = (uint32_t)switch_bench_start;
+    switch_bench_pong->eip = (uint32_t)switch_bench_start;
+    
+    process_handoff(switch_bench_ping);
+    
+    /* Back from ping; both threads are parked in process_handoff() */
+    process_release(switch_bench_ping);
+    process_release(switch_bench_pong);
+    irq_restore(flags);
+    
+    /* Insertion sort is plenty for a couple of thousand samples */
+    uint32_t count = switch_sample_count;
+    for (uint32_t i = 1; i < count; i++) {
+        uint32_t value = switch_samples[i];
+        uint32_t j = i;
+        while (j > 0 && switch_samples[j - 1] > value) {
+            switch_samples[j] = switch_samples[j - 1];
+            j--;
+        }
+        switch_samples[j] = value;
+    }
+    
+    uint32_t median = switch_samples[count / 2];
+    uint32_t p99 = switch_samples[(count * 99) / 100];
+    serial_printf("switchbench: %u switches, min %u, median %u, p99 %u, max %u cycles\n",
+                  count, switch_samples[0], median, p99, switch_samples[count - 1]);
+    vga_printf("%u switches: min %u, median %u, p99 %u, max %u TSC cycles\n",
+               count, switch_samples[0], median, p99, switch_samples[count - 1]);
+}
\ No newline at end of file
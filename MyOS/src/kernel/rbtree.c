@@ -0,0 +1,213 @@
+#include "rbtree.h"
+
+static void rb_rotate_left(rb_node_t* node, rb_root_t* root) {
+    rb_node_t* right = node->right;
+    
+    node->right = right->left;
+    if (right->left) right->left->parent = node;
+    
+    right->parent = node->parent;
+    if (!node->parent) root->node = right;
+    else if (node == node->parent->left) node->parent->left = right;
+    else node->parent->right = right;
+    
+    right->left = node;
+    node->parent = right;
+}
+
+static void rb_rotate_right(rb_node_t* node, rb_root_t* root) {
+    rb_node_t* left = node->left;
+    
+    node->left = left->right;
+    if (left->right) left->right->parent = node;
+    
+    left->parent = node->parent;
+    if (!node->parent) root->node = left;
+    else if (node == node->parent->right) node->parent->right = left;
+    else node->parent->left = left;
+    
+    left->right = node;
+    node->parent = left;
+}
+
+/* Link node at *link below parent, then restore the red-black properties */
+void rb_insert(rb_node_t* node, rb_node_t* parent, rb_node_t** link, rb_root_t* root) {
+    node->parent = parent;
+    node->left = NULL;
+    node->right = NULL;
+    node->color = RB_RED;
+    *link = node;
+    
+    while ((parent = node->parent) && parent->color == RB_RED) {
+        rb_node_t* grandparent = parent->parent;
+        
+        if (parent == grandparent->left) {
+            rb_node_t* uncle = grandparent->right;
+            if (uncle && uncle->color == RB_RED) {
+                /* Recolour and carry on from the grandparent */
+                uncle->color = RB_BLACK;
+                parent->color = RB_BLACK;
+                grandparent->color = RB_RED;
+                node = grandparent;
+                continue;
+            }
+            if (node == parent->right) {
+                rb_rotate_left(parent, root);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->color = RB_BLACK;
+            grandparent->color = RB_RED;
+            rb_rotate_right(grandparent, root);
+        } else {
+            rb_node_t* uncle = grandparent->left;
+            if (uncle && uncle->color == RB_RED) {
+                uncle->color = RB_BLACK;
+                parent->color = RB_BLACK;
+                grandparent->color = RB_RED;
+                node = grandparent;
+                continue;
+            }
+            if (node == parent->left) {
+                rb_rotate_right(parent, root);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->color = RB_BLACK;
+            grandparent->color = RB_RED;
+            rb_rotate_left(grandparent, root);
+        }
+    }
+    
+    root->node->color = RB_BLACK;
+}
+
+/* Rebalance after removing a black node; node (possibly NULL) took its place
+ * below parent */
+static void rb_erase_fixup(rb_node_t* node, rb_node_t* parent, rb_root_t* root) {
+    while (node != root->node && (!node || node->color == RB_BLACK)) {
+        if (node == parent->left) {
+            rb_node_t* sibling = parent->right;
+            if (sibling->color == RB_RED) {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_left(parent, root);
+                sibling = parent->right;
+            }
+            if ((!sibling->left || sibling->left->color == RB_BLACK) &&
+                (!sibling->right || sibling->right->color == RB_BLACK)) {
+                sibling->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (!sibling->right || sibling->right->color == RB_BLACK) {
+                sibling->left->color = RB_BLACK;
+                sibling->color = RB_RED;
+                rb_rotate_right(sibling, root);
+                sibling = parent->right;
+            }
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->right->color = RB_BLACK;
+            rb_rotate_left(parent, root);
+            node = root->node;
+        } else {
+            rb_node_t* sibling = parent->left;
+            if (sibling->color == RB_RED) {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_right(parent, root);
+                sibling = parent->left;
+            }
+            if ((!sibling->left || sibling->left->color == RB_BLACK) &&
+                (!sibling->right || sibling->right->color == RB_BLACK)) {
+                sibling->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (!sibling->left || sibling->left->color == RB_BLACK) {
+                sibling->right->color = RB_BLACK;
+                sibling->color = RB_RED;
+                rb_rotate_left(sibling, root);
+                sibling = parent->left;
+            }
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->left->color = RB_BLACK;
+            rb_rotate_right(parent, root);
+            node = root->node;
+        }
+    }
+    
+    if (node) node->color = RB_BLACK;
+}
+
+static void rb_replace_child(rb_node_t* old, rb_node_t* new, rb_node_t* parent, rb_root_t* root) {
+    if (!parent) root->node = new;
+    else if (parent->left == old) parent->left = new;
+    else parent->right = new;
+}
+
+void rb_erase(rb_node_t* node, rb_root_t* root) {
+    rb_node_t* child;
+    rb_node_t* parent;
+    int color;
+    
+    if (node->left && node->right) {
+        /* Swap in the in-order successor, which has no left child */
+        rb_node_t* successor = node->right;
+        while (successor->left) successor = successor->left;
+        
+        child = successor->right;
+        parent = successor->parent;
+        color = successor->color;
+        
+        if (parent == node) {
+            parent = successor;
+        } else {
+            if (child) child->parent = parent;
+            parent->left = child;
+            successor->right = node->right;
+            node->right->parent = successor;
+        }
+        
+        rb_replace_child(node, successor, node->parent, root);
+        successor->parent = node->parent;
+        successor->color = node->color;
+        successor->left = node->left;
+        node->left->parent = successor;
+    } else {
+        child = node->left ? node->left : node->right;
+        parent = node->parent;
+        color = node->color;
+        
+        if (child) child->parent = parent;
+        rb_replace_child(node, child, parent, root);
+    }
+    
+    if (color == RB_BLACK) rb_erase_fixup(child, parent, root);
+}
+
+rb_node_t* rb_first(rb_root_t* root) {
+    rb_node_t* node = root->node;
+    if (!node) return NULL;
+    while (node->left) node = node->left;
+    return node;
+}
+
+rb_node_t* rb_next(rb_node_t* node) {
+    if (node->right) {
+        node = node->right;
+        while (node->left) node = node->left;
+        return node;
+    }
+    
+    rb_node_t* parent = node->parent;
+    while (parent && node == parent->right) {
+        node = parent;
+        parent = node->parent;
+    }
+    return parent;
+}
\ No newline at end of file
@@ -0,0 +1,166 @@
+#include "process.h"
+#include "kernel.h"
+#include "vga.h"
+#include "smp.h"
+
+/*
+ * Fair scheduling class, selected with sched=cfs. READY tasks sit in a
+ * red-black tree ordered by virtual runtime: CPU time scaled down by the
+ * task's weight, so heavier (higher priority) tasks age more slowly. The
+ * leftmost task, the one that has had the least, runs next.
+ *
+ * Tasks that may run anywhere share one tree. Pinned ones, which include
+ * every task with an address space of its own, wait in a tree of their
+ * CPU's, so a pick only compares two leftmost nodes.
+ */
+#define FAIR_NICE_0_WEIGHT  1024
+#define FAIR_TICK_US        (1000000 / TIMER_FREQUENCY)
+#define FAIR_LATENCY        20      /* Ticks in which every task should run once */
+#define FAIR_MIN_GRANULARITY 2      /* Shortest slice in ticks */
+
+/* Linux's nice-to-weight table for nice 15 down to -16: each priority step
+ * is worth about 25% more CPU, and priority 16 is the nice 0 weight */
+static const uint32_t fair_weights[SCHED_PRIORITIES] = {
+    36, 46, 56, 70, 87, 110, 137, 172,
+    215, 272, 335, 423, 526, 655, 820, 1024,
+    1277, 1586, 1991, 2501, 3121, 3906, 4904, 6100,
+    7620, 9548, 11916, 14949, 18705, 23254, 29154, 36291
+};
+
+typedef struct fair_queue {
+    rb_root_t tree;
+    rb_node_t* leftmost;
+} fair_queue_t;
+
+static fair_queue_t fair_shared;
+static fair_queue_t fair_pinned[MAX_CPUS];
+static uint32_t fair_nr_queued = 0;
+static uint32_t fair_load = 0;          /* Sum of the queued tasks' weights */
+static uint32_t fair_min_vruntime = 0;  /* Never moves backwards */
+
+/* vruntime is in weighted microseconds and wraps, compare by difference */
+static inline int fair_before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+static inline uint32_t fair_weight(process_t* proc) {
+    return fair_weights[proc->priority];
+}
+
+static inline fair_queue_t* fair_queue(process_t* proc) {
+    return (proc->flags & PROCESS_PINNED) ? &fair_pinned[proc->cpu] : &fair_shared;
+}
+
+static inline process_t* fair_queue_first(fair_queue_t* queue) {
+    return queue->leftmost ? rb_entry(queue->leftmost, process_t, run_node) : NULL;
+}
+
+/* The task with the smallest vruntime that cpu may run */
+static process_t* fair_first(uint32_t cpu) {
+    process_t* shared = fair_queue_first(&fair_shared);
+    process_t* pinned = fair_queue_first(&fair_pinned[cpu]);
+    if (!shared) return pinned;
+    if (!pinned) return shared;
+    return fair_before(pinned->vruntime, shared->vruntime) ? pinned : shared;
+}
+
+static void fair_update_min_vruntime(process_t* curr, uint32_t cpu) {
+    uint32_t vruntime = fair_min_vruntime;
+    int found = 0;
+    
+    if (curr) {
+        vruntime = curr->vruntime;
+        found = 1;
+    }
+    process_t* first = fair_first(cpu);
+    if (first) {
+        if (!found || fair_before(first->vruntime, vruntime)) vruntime = first->vruntime;
+        found = 1;
+    }
+    
+    if (found && fair_before(fair_min_vruntime, vruntime)) {
+        fair_min_vruntime = vruntime;
+    }
+}
+
+/* New tasks start level with the queue rather than at zero */
+void fair_task_init(process_t* proc) {
+    proc->vruntime = fair_min_vruntime;
+}
+
+void fair_enqueue(process_t* proc) {
+    /* A task back from a long sleep gets at most half a latency period of
+     * credit, so it cannot monopolise the CPU to catch up */
+    uint32_t floor = fair_min_vruntime - FAIR_LATENCY * FAIR_TICK_US / 2;
+    if (fair_before(proc->vruntime, floor)) proc->vruntime = floor;
+    
+    fair_queue_t* queue = fair_queue(proc);
+    rb_node_t** link = &queue->tree.node;
+    rb_node_t* parent = NULL;
+    int leftmost = 1;
+    while (*link) {
+        parent = *link;
+        /* Equal keys go right, so tasks with the same vruntime run FIFO */
+        if (fair_before(proc->vruntime, rb_entry(parent, process_t, run_node)->vruntime)) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+            leftmost = 0;
+        }
+    }
+    
+    rb_insert(&proc->run_node, parent, link, &queue->tree);
+    if (leftmost) queue->leftmost = &proc->run_node;
+    fair_nr_queued++;
+    fair_load += fair_weight(proc);
+}
+
+void fair_dequeue(process_t* proc) {
+    fair_queue_t* queue = fair_queue(proc);
+    if (queue->leftmost == &proc->run_node) {
+        queue->leftmost = rb_next(queue->leftmost);
+    }
+    rb_erase(&proc->run_node, &queue->tree);
+    fair_nr_queued--;
+    fair_load -= fair_weight(proc);
+}
+
+/* Take the task with the smallest vruntime that cpu may run off the tree */
+process_t* fair_pick(uint32_t cpu) {
+    process_t* proc = fair_first(cpu);
+    if (!proc) return NULL;
+    
+    fair_dequeue(proc);
+    fair_update_min_vruntime(proc, cpu);
+    return proc;
+}
+
+int fair_runnable(uint32_t cpu) {
+    return fair_first(cpu) != NULL;
+}
+
+/* Charge ticks of CPU time to the running task */
+void fair_account(process_t* curr, uint32_t ticks) {
+    if (ticks > 4000) ticks = 4000; /* Keeps the product in 32 bits */
+    curr->vruntime += ticks * FAIR_TICK_US * FAIR_NICE_0_WEIGHT / fair_weight(curr);
+    fair_update_min_vruntime(curr, curr->cpu);
+}
+
+/* The latency period is shared out by weight. With many tasks it stretches
+ * so nobody gets less than the minimum granularity. */
+uint32_t fair_timeslice(process_t* proc) {
+    uint32_t nr_running = fair_nr_queued + 1;
+    uint32_t period = FAIR_LATENCY;
+    if (nr_running * FAIR_MIN_GRANULARITY > period) {
+        period = nr_running * FAIR_MIN_GRANULARITY;
+    }
+    
+    uint32_t weight = fair_weight(proc);
+    uint32_t slice = period * weight / (fair_load + weight);
+    return slice > FAIR_MIN_GRANULARITY ? slice : FAIR_MIN_GRANULARITY;
+}
+
+void fair_info(void) {
+    vga_printf("Scheduler: fair, %u queued, load %u, min vruntime %u us\n",
+               fair_nr_queued, fair_load, fair_min_vruntime);
+}
\ No newline at end of file
@@ -4,10 +4,17 @@
 #include "keyboard.h"
 #include "process.h"
 #include "memory.h"
+#include "arena.h"
+#include "fpu.h"
+#include "softirq.h"
+#include "smp.h"
+#include "sync.h"
+#include "syscall.h"
+#include "vdso.h"
 
 static char current_directory[MAX_PATH_LENGTH] = "/";
 static char command_buffer[MAX_COMMAND_LENGTH];
-static char* argv_buffer[MAX_ARGS];
+static arena_t* shell_arena = NULL;   /* Scratch memory for one command */
 static uint32_t system_start_time = 0;
 
 /* Built-in commands table */
@@ -24,6 +31,19 @@ static shell_command_t builtin_commands[] = {
     {"cd", "Change directory", cmd_cd},
     {"pwd", "Print working directory", cmd_pwd},
     {"free", "Show memory usage", cmd_free},
+    {"forkbench", "Measure fork latency against resident set size", cmd_forkbench},
+    {"arenabench", "Compare arena and kmalloc scratch allocations", cmd_arenabench},
+    {"switchbench", "Measure context switch latency", cmd_switchbench},
+    {"timers", "Show timer wheel and sleep statistics", cmd_timers},
+    {"softirqs", "Show bottom half statistics", cmd_softirqs},
+    {"cpus", "Show processors and kernel lock statistics", cmd_cpus},
+    {"smpbench", "Measure parallel speedup of a CPU-bound loop", cmd_smpbench},
+    {"locks", "Show mutex and semaphore contention", cmd_locks},
+    {"syncbench", "Run mutex, semaphore and condition variable workers", cmd_syncbench},
+    {"syscallbench", "Compare int 0x80 and sysenter system call cost", cmd_syscallbench},
+#ifdef CONFIG_KMALLOC_PROFILE
+    {"kmprof", "Show kmalloc callers and old allocations", cmd_kmprof},
+#endif
     {"uptime", "Show system uptime", cmd_uptime},
     {"uname", "Show system information", cmd_uname},
     {"whoami", "Show current user", cmd_whoami},
@@ -35,6 +55,10 @@ static shell_command_t builtin_commands[] = {
 
 void shell_init(void) {
     system_start_time = 0; /* Initialize with timer when available */
+    shell_arena = arena_create();
+    if (!shell_arena) {
+        kernel_panic("Out of memory for the shell arena");
+    }
     vga_puts("MyOS Shell initialized\n");
 }
 
@@ -110,19 +134,26 @@ int shell_execute(char* command_line) {
         return 0;
     }
     
-    int argc = shell_parse_command(command_line, argv_buffer);
+    /* Everything the previous command used is released in one go */
+    arena_reset(shell_arena);
+    char* line = arena_alloc(shell_arena, strlen(command_line) + 1);
+    char** argv = arena_alloc(shell_arena, MAX_ARGS * sizeof(char*));
+    if (!line || !argv) return -1;
+    strcpy(line, command_line);
+    
+    int argc = shell_parse_command(line, argv);
     if (argc == 0) return 0;
     
     /* Look for built-in command */
     for (int i = 0; builtin_commands[i].name; i++) {
-        if (strcmp(argv_buffer[0], builtin_commands[i].name) == 0) {
-            return builtin_commands[i].function(argc, argv_buffer);
+        if (strcmp(argv[0], builtin_commands[i].name) == 0) {
+            return builtin_commands[i].function(argc, argv);
         }
     }
     
     /* Command not found */
     vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-    vga_printf("%s: command not found\n", argv_buffer[0]);
+    vga_printf("%s: command not found\n", argv[0]);
     vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
     return -1;
 }
@@ -165,6 +196,7 @@ int cmd_echo(int argc, char* argv[]) {
 int cmd_ps(int argc, char* argv[]) {
     (void)argc; (void)argv;
     process_list();
+    fpu_info();
     return 0;
 }
 
@@ -265,8 +297,216 @@ int cmd_cd(int argc, char* argv[]) {
 int cmd_free(int argc, char* argv[]) {
     (void)argc; (void)argv;
     memory_info();
+    
+    /* Heap fragmentation: how much of the free space is usable in one piece */
+    uint32_t heap_free = 0;
+    uint32_t heap_largest = 0;
+    heap_get_stats(&heap_free, &heap_largest);
+    
+    vga_printf("\nHeap free:     %d KB\n", heap_free / 1024);
+    vga_printf("Largest block: %d KB\n", heap_largest / 1024);
+    uint32_t fragmentation = 0;
+    if (heap_free >= 100) {
+        uint32_t usable = heap_largest / (heap_free / 100);
+        fragmentation = (usable < 100) ? 100 - usable : 0;
+    }
+    vga_printf("Fragmentation: %d%%\n", fragmentation);
+    return 0;
+}
+
+int cmd_forkbench(int argc, char* argv[]) {
+    (void)argc; (void)argv;
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_puts("Copy-on-write fork latency:\n");
+    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+    process_fork_benchmark();
+    
+    return 0;
+}
+
+int cmd_arenabench(int argc, char* argv[]) {
+    (void)argc; (void)argv;
+    
+    /* A command-like workload: a burst of small buffers that die together */
+    static const uint32_t sizes[] = {16, 24, 40, 64, 128, 256, 32, 512};
+    const uint32_t rounds = 1000;
+    const uint32_t burst = 32;
+    void* objects[32];
+    
+    arena_t* arena = arena_create();
+    if (!arena) {
+        vga_puts("arenabench: out of memory\n");
+        return -1;
+    }
+    
+    uint64_t start = rdtsc();
+    for (uint32_t r = 0; r < rounds; r++) {
+        for (uint32_t i = 0; i < burst; i++) {
+            objects[i] = kmalloc(sizes[i % 8]);
+        }
+        for (uint32_t i = 0; i < burst; i++) {
+            kfree(objects[i]);
+        }
+    }
+    uint32_t heap_cycles = (uint32_t)(rdtsc() - start);
+    
+    start = rdtsc();
+    for (uint32_t r = 0; r < rounds; r++) {
+        for (uint32_t i = 0; i < burst; i++) {
+            objects[i] = arena_alloc(arena, sizes[i % 8]);
+        }
+        arena_reset(arena);
+    }
+    uint32_t arena_cycles = (uint32_t)(rdtsc() - start);
+    arena_destroy(arena);
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_printf("%u rounds of %u allocations:\n", rounds, burst);
+    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+    vga_printf("kmalloc/kfree:      %u cycles/round\n", heap_cycles / rounds);
+    vga_printf("arena_alloc/reset:  %u cycles/round\n", arena_cycles / rounds);
+    
+    return 0;
+}
+
+int cmd_switchbench(int argc, char* argv[]) {
+    (void)argc; (void)argv;
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_puts("Kernel thread ping-pong (results also on serial):\n");
+    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+    process_switch_benchmark();
+    
+    return 0;
+}
+
+int cmd_timers(int argc, char* argv[]) {
+    /* timers <ms> sleeps a few times first to exercise the wheel */
+    if (argc >= 2) {
+        uint32_t ms = 0;
+        for (int i = 0; argv[1][i]; i++) {
+            if (argv[1][i] < '0' || argv[1][i] > '9') {
+                vga_puts("Usage: timers [ms]\n");
+                return -1;
+            }
+            ms = ms * 10 + (argv[1][i] - '0');
+        }
+        for (int i = 0; i < 10; i++) {
+            process_sleep(ms);
+        }
+    }
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_puts("Timer statistics:\n");
+    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+    timer_info();
+    timer_wheel_info();
+    process_sleep_info();
+    vdso_info();
+    
+    return 0;
+}
+
+int cmd_softirqs(int argc, char* argv[]) {
+    (void)argc; (void)argv;
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_puts("Bottom halves:\n");
+    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+    softirq_info();
+    
+    return 0;
+}
+
+int cmd_cpus(int argc, char* argv[]) {
+    (void)argc; (void)argv;
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_printf("%u CPUs online:\n", smp_cpu_count);
+    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+    smp_info();
+    
+    return 0;
+}
+
+int cmd_smpbench(int argc, char* argv[]) {
+    /* smpbench <threads> overrides one thread per CPU */
+    uint32_t threads = 0;
+    if (argc >= 2) {
+        for (int i = 0; argv[1][i]; i++) {
+            if (argv[1][i] < '0' || argv[1][i] > '9') {
+                vga_puts("Usage: smpbench [threads]\n");
+                return -1;
+            }
+            threads = threads * 10 + (argv[1][i] - '0');
+        }
+    }
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_puts("Parallel CPU-bound benchmark:\n");
+    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+    smp_benchmark(threads);
+    
+    return 0;
+}
+
+int cmd_locks(int argc, char* argv[]) {
+    (void)argc; (void)argv;
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_puts("Lock contention:\n");
+    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+    sync_info();
+    
+    return 0;
+}
+
+int cmd_syncbench(int argc, char* argv[]) {
+    (void)argc; (void)argv;
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_puts("Blocking synchronization benchmark:\n");
+    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+    sync_benchmark();
+    sync_info();
+    
+    return 0;
+}
+
+int cmd_syscallbench(int argc, char* argv[]) {
+    (void)argc; (void)argv;
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_printf("getpid from user mode, %u calls each way:\n", SYSCALL_BENCH_ROUNDS);
+    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+    syscall_benchmark();
+    
+    return 0;
+}
+
+#ifdef CONFIG_KMALLOC_PROFILE
+int cmd_kmprof(int argc, char* argv[]) {
+    uint32_t min_age = 10;
+    if (argc >= 2) {
+        min_age = 0;
+        for (int i = 0; argv[1][i]; i++) {
+            if (argv[1][i] < '0' || argv[1][i] > '9') {
+                vga_puts("Usage: kmprof [seconds]\n");
+                return -1;
+            }
+            min_age = min_age * 10 + (argv[1][i] - '0');
+        }
+    }
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_puts("kmalloc profile:\n");
+    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+    kmalloc_profile_report(min_age);
+    
     return 0;
 }
+#endif
 
 int cmd_uptime(int argc, char* argv[]) {
     (void)argc; (void)argv;
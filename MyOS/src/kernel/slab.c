@@ -0,0 +1,161 @@
+#include "memory.h"
+#include "kernel.h"
+#include "vga.h"
+#include "cpu.h"
+
+/* Per size class cache */
+typedef struct slab_cache {
+    uint32_t object_size;
+    page_t* partial;        /* Slab pages with at least one free object */
+    page_t* empty;          /* One fully free page kept to avoid thrashing */
+    uint32_t pages;         /* Pages currently owned by this class */
+    uint32_t active;        /* Objects currently allocated */
+    uint32_t hits;          /* Allocations served from an existing page */
+    uint32_t misses;        /* Allocations that needed a fresh page */
+    uint32_t frees;
+} slab_cache_t;
+
+static slab_cache_t slab_caches[SLAB_CLASSES];
+
+static uint32_t slab_class_index(uint32_t size) {
+    if (size <= SLAB_MIN_SIZE) return 0;
+    /* Round up to the next power of two */
+    return (32 - __builtin_clz(size - 1)) - SLAB_MIN_SHIFT;
+}
+
+static void slab_list_add(page_t** list, page_t* page) {
+    page->prev = NULL;
+    page->next = *list;
+    if (*list) (*list)->prev = page;
+    *list = page;
+}
+
+static void slab_list_remove(page_t** list, page_t* page) {
+    if (page->prev) page->prev->next = page->next;
+    else *list = page->next;
+    if (page->next) page->next->prev = page->prev;
+    page->next = NULL;
+    page->prev = NULL;
+}
+
+/* Carve a fresh page into objects and thread them onto its freelist */
+static page_t* slab_grow(slab_cache_t* cache, uint32_t class_index) {
+    uint32_t phys = alloc_page();
+    if (!phys) return NULL;
+    
+    page_t* page = phys_to_page(phys);
+    if (!page) {
+        free_page(phys);
+        return NULL;
+    }
+    
+    uint32_t count = PAGE_SIZE / cache->object_size;
+    uint8_t* base = PHYS_TO_VIRT(phys);
+    for (uint32_t i = 0; i < count - 1; i++) {
+        *(void**)(base + i * cache->object_size) = base + (i + 1) * cache->object_size;
+    }
+    *(void**)(base + (count - 1) * cache->object_size) = NULL;
+    
+    page->flags = PAGE_FLAG_SLAB;
+    page->freelist = base;
+    page->inuse = 0;
+    page->slab_class = class_index;
+    cache->pages++;
+    return page;
+}
+
+void slab_init(void) {
+    for (uint32_t i = 0; i < SLAB_CLASSES; i++) {
+        slab_caches[i].object_size = SLAB_MIN_SIZE << i;
+        slab_caches[i].partial = NULL;
+        slab_caches[i].empty = NULL;
+        slab_caches[i].pages = 0;
+        slab_caches[i].active = 0;
+        slab_caches[i].hits = 0;
+        slab_caches[i].misses = 0;
+        slab_caches[i].frees = 0;
+    }
+}
+
+void* slab_alloc(uint32_t size) {
+    if (size > SLAB_MAX_SIZE) return NULL;
+    
+    uint32_t class_index = slab_class_index(size);
+    slab_cache_t* cache = &slab_caches[class_index];
+    uint32_t flags = irq_save();
+    page_t* page = cache->partial;
+    
+    if (page) {
+        cache->hits++;
+    } else {
+        cache->misses++;
+        if (cache->empty) {
+            page = cache->empty;
+            cache->empty = NULL;
+        } else {
+            page = slab_grow(cache, class_index);
+            if (!page) {
+                irq_restore(flags);
+                return NULL;
+            }
+        }
+        slab_list_add(&cache->partial, page);
+    }
+    
+    void* obj = page->freelist;
+    page->freelist = *(void**)obj;
+    page->inuse++;
+    cache->active++;
+    
+    /* Full pages leave the partial list until an object comes back */
+    if (!page->freelist) {
+        slab_list_remove(&cache->partial, page);
+    }
+    irq_restore(flags);
+    
+    return obj;
+}
+
+void slab_free(void* ptr) {
+    page_t* page = phys_to_page(VIRT_TO_PHYS(ptr));
+    if (!page || !(page->flags & PAGE_FLAG_SLAB)) return;
+    
+    slab_cache_t* cache = &slab_caches[page->slab_class];
+    uint32_t flags = irq_save();
+    
+    /* A full page goes back on the partial list */
+    if (!page->freelist) {
+        slab_list_add(&cache->partial, page);
+    }
+    
+    *(void**)ptr = page->freelist;
+    page->freelist = ptr;
+    page->inuse--;
+    cache->active--;
+    cache->frees++;
+    
+    if (page->inuse == 0) {
+        slab_list_remove(&cache->partial, page);
+        if (!cache->empty) {
+            cache->empty = page;
+        } else {
+            /* Already caching an empty page, return this one */
+            page->flags = 0;
+            page->freelist = NULL;
+            cache->pages--;
+            free_page(page_to_phys(page));
+        }
+    }
+    irq_restore(flags);
+}
+
+void slab_info(void) {
+    vga_puts("\nSlab allocator:\n");
+    vga_puts("Size\tPages\tActive\tHits\tMisses\tFrees\n");
+    for (uint32_t i = 0; i < SLAB_CLASSES; i++) {
+        slab_cache_t* cache = &slab_caches[i];
+        vga_printf("%d\t%d\t%d\t%d\t%d\t%d\n",
+                   cache->object_size, cache->pages, cache->active,
+                   cache->hits, cache->misses, cache->frees);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,302 @@
+#include "smp.h"
+#include "apic.h"
+#include "acpi.h"
+#include "cpu.h"
+#include "tss.h"
+#include "fpu.h"
+#include "memory.h"
+#include "interrupts.h"
+#include "process.h"
+#include "timer.h"
+#include "kernel.h"
+#include "vga.h"
+#include "cmdline.h"
+#include "syscall.h"
+
+/* ap_boot.asm */
+extern uint8_t ap_trampoline_start[];
+extern uint8_t ap_trampoline_end[];
+extern uint8_t ap_trampoline_cr3[];
+extern uint8_t ap_trampoline_stack[];
+extern uint8_t ap_trampoline_cpu[];
+
+cpu_t cpus[MAX_CPUS];
+uint32_t smp_cpu_count = 1;
+volatile int smp_active = 0;
+
+static uint32_t ap_boot_stack = 0;  /* Stack of the AP being started */
+
+/*
+ * Big kernel lock. Once the APs run, irq_save() takes it as well as
+ * disabling interrupts, so every section that was safe against interrupts
+ * on one CPU stays safe against the others. It nests per CPU; the depth
+ * is carried by the task across a context switch (context_switch()).
+ */
+static volatile int bkl_locked = 0;
+static volatile uint32_t bkl_owner = 0;    /* CPU id + 1, 0 when free */
+static uint32_t bkl_acquisitions = 0;
+static uint32_t bkl_contended = 0;
+static uint32_t tlb_shootdowns = 0;
+
+/* Requests another CPU may be spinning on, served even while this one
+ * waits for the lock with interrupts off */
+static void smp_poll(cpu_t* cpu) {
+    if (cpu->tlb_flush) {
+        tlb_flush_all();
+        cpu->tlb_flush = 0;
+    }
+}
+
+void bkl_acquire(void) {
+    cpu_t* cpu = this_cpu();
+    if (bkl_owner == cpu->id + 1) {
+        cpu->lock_depth++;
+        return;
+    }
+    
+    int contended = 0;
+    while (__sync_lock_test_and_set(&bkl_locked, 1)) {
+        contended = 1;
+        while (bkl_locked) {
+            smp_poll(cpu);
+            cpu_relax();
+        }
+    }
+    bkl_owner = cpu->id + 1;
+    cpu->lock_depth = 1;
+    bkl_acquisitions++;
+    bkl_contended += contended;
+}
+
+void bkl_release(void) {
+    cpu_t* cpu = this_cpu();
+    if (--cpu->lock_depth == 0) {
+        bkl_owner = 0;
+        __sync_lock_release(&bkl_locked);
+    }
+}
+
+/* Let go of the lock entirely, for a new task that inherited it from
+ * whoever switched to it */
+void bkl_drop(void) {
+    cpu_t* cpu = this_cpu();
+    if (!smp_active || bkl_owner != cpu->id + 1) return;
+    cpu->lock_depth = 1;
+    bkl_release();
+}
+
+/* Point GS at this CPU's cpu_t through its own GDT entry */
+static void percpu_init(uint32_t id) {
+    cpu_t* cpu = &cpus[id];
+    cpu->self = cpu;
+    cpu->id = id;
+    cpu->directory = kernel_page_directory();   /* NULL on the BSP until paging_init() */
+    gdt_set_entry(PERCPU_SELECTOR(id), (uint32_t)cpu, sizeof(cpu_t) - 1, 0x92, 0x40);
+    __asm__ volatile ("mov %w0, %%gs" : : "r"(PERCPU_SELECTOR(id)) : "memory");
+}
+
+/* The BSP's per-CPU area, before anything calls this_cpu() */
+void smp_early_init(void) {
+    percpu_init(0);
+    cpus[0].online = 1;
+}
+
+/* C entry of an AP, on the stack smp_boot_cpu() gave it. Interrupts are off
+ * and the big kernel lock is not held. */
+void ap_main(uint32_t id) {
+    percpu_init(id);
+    idt_load();
+    tss_init();
+    syscall_init_cpu();
+    fpu_init_cpu();
+    apic_init_cpu();
+    process_init_cpu(ap_boot_stack);
+    apic_timer_start();
+    
+    cpus[id].online = 1;
+    __asm__ volatile ("sti");
+    idle_process();
+}
+
+/* INIT, then up to two startup IPIs as the MP specification asks, and wait
+ * for the AP to check in from ap_main() */
+static int smp_boot_cpu(uint32_t id, uint32_t apic) {
+    void* stack = vmalloc(STACK_SIZE);
+    if (!stack) return 0;
+    
+    cpus[id].apic_id = apic;
+    ap_boot_stack = (uint32_t)stack;
+    
+    uint8_t* trampoline = PHYS_TO_VIRT(AP_TRAMPOLINE_PHYS);
+    *(uint32_t*)(trampoline + (ap_trampoline_cr3 - ap_trampoline_start)) =
+        VIRT_TO_PHYS(kernel_page_directory());
+    *(uint32_t*)(trampoline + (ap_trampoline_stack - ap_trampoline_start)) =
+        (uint32_t)stack + STACK_SIZE;
+    *(uint32_t*)(trampoline + (ap_trampoline_cpu - ap_trampoline_start)) = id;
+    
+    apic_send_ipi(apic, ICR_INIT | ICR_LEVEL_ASSERT | ICR_LEVEL_TRIGGER);
+    apic_send_ipi(apic, ICR_INIT | ICR_LEVEL_TRIGGER);
+    timer_udelay(10000);
+    
+    for (int attempt = 0; attempt < 2 && !cpus[id].online; attempt++) {
+        apic_send_ipi(apic, ICR_STARTUP | (AP_TRAMPOLINE_PHYS >> 12));
+        timer_udelay(200);
+    }
+    for (uint32_t ms = 0; ms < AP_BOOT_TIMEOUT_MS && !cpus[id].online; ms++) {
+        timer_udelay(1000);
+    }
+    
+    /* A late starter may still be using the stack, so it is not freed */
+    if (!cpus[id].online) {
+        vga_printf("CPU %u (APIC %u) did not start\n", id, apic);
+        return 0;
+    }
+    return 1;
+}
+
+/* Find the processors in the MADT and start every AP. nosmp on the
+ * command line keeps the kernel on the BSP. Runs before interrupts are
+ * enabled, so no task has been switched out yet. */
+void smp_init(void) {
+    acpi_smp_info_t info;
+    if (!acpi_find_cpus(&info)) {
+        vga_puts("No ACPI MADT, running on one CPU\n");
+        return;
+    }
+    if (!apic_init(info.lapic_address)) {
+        vga_puts("Cannot map the local APIC\n");
+        return;
+    }
+    
+    cpus[0].apic_id = apic_id();
+    apic_init_cpu();
+    if (info.cpu_count < 2 || cmdline_has("nosmp")) {
+        vga_printf("SMP: 1 of %u CPUs used\n", info.cpu_count);
+        return;
+    }
+    apic_timer_calibrate();
+    
+    /* The trampoline is identity mapped for the instructions that turn
+     * paging on; kernel directory entries below 3GB are not shared */
+    memcpy(PHYS_TO_VIRT(AP_TRAMPOLINE_PHYS), ap_trampoline_start,
+           ap_trampoline_end - ap_trampoline_start);
+    if (!map_page(AP_TRAMPOLINE_PHYS, AP_TRAMPOLINE_PHYS, PAGE_PRESENT | PAGE_WRITE)) {
+        vga_puts("SMP: cannot map the AP trampoline\n");
+        return;
+    }
+    
+    smp_active = 1;
+    for (uint32_t i = 0; i < info.cpu_count && smp_cpu_count < MAX_CPUS; i++) {
+        if (info.apic_ids[i] == cpus[0].apic_id) continue;
+        if (smp_boot_cpu(smp_cpu_count, info.apic_ids[i])) smp_cpu_count++;
+    }
+    
+    uint32_t flags = irq_save();
+    unmap_page(AP_TRAMPOLINE_PHYS);
+    smp_tlb_shootdown();
+    irq_restore(flags);
+    
+    if (smp_cpu_count == 1) smp_active = 0;
+    vga_printf("SMP: %u of %u CPUs online\n", smp_cpu_count, info.cpu_count);
+}
+
+void smp_send_reschedule(uint32_t cpu) {
+    cpus[cpu].need_resched = 1;
+    apic_send_ipi(cpus[cpu].apic_id, IPI_VECTOR);
+}
+
+/* Make every other CPU drop its TLB and wait until it has. The caller holds
+ * the lock; CPUs spinning for it flush from smp_poll(), the rest from the
+ * IPI. Kernel mappings that change are never global, a CR3 reload does. */
+void smp_tlb_shootdown(void) {
+    if (!smp_active) return;
+    
+    uint32_t self = this_cpu()->id;
+    for (uint32_t i = 0; i < smp_cpu_count; i++) {
+        if (i == self || !cpus[i].online) continue;
+        cpus[i].tlb_flush = 1;
+        apic_send_ipi(cpus[i].apic_id, IPI_VECTOR);
+    }
+    for (uint32_t i = 0; i < smp_cpu_count; i++) {
+        while (cpus[i].tlb_flush) {
+            cpu_relax();
+        }
+    }
+    tlb_shootdowns++;
+}
+
+/* A reschedule request only set need_resched, irq_exit() acts on it */
+void smp_ipi_handler(void) {
+    cpu_t* cpu = this_cpu();
+    cpu->ipis++;
+    smp_poll(cpu);
+}
+
+void smp_info(void) {
+    vga_puts("CPU  APIC  Running        Ticks     Idle  IPIs\n");
+    uint32_t flags = irq_save();
+    for (uint32_t i = 0; i < smp_cpu_count; i++) {
+        cpu_t* cpu = &cpus[i];
+        if (!cpu->online) continue;
+        
+        uint32_t idle = cpu->ticks ? cpu->idle_ticks * 100 / cpu->ticks : 0;
+        vga_printf("%-3u  %-4u  %-13s  %-8u  %3u%%  %u\n", i, cpu->apic_id,
+                   cpu->current ? cpu->current->name : "-",
+                   cpu->ticks, idle, cpu->ipis);
+    }
+    irq_restore(flags);
+    vga_printf("Kernel lock: %u acquisitions, %u contended; %u TLB shootdowns\n",
+               bkl_acquisitions, bkl_contended, tlb_shootdowns);
+}
+
+/* Parallel benchmark: the same CPU-bound loop in one thread, then in one
+ * thread per CPU. With perfect scaling both take the same time. */
+#define SMP_BENCH_ROUNDS 20000000
+
+static volatile uint32_t smp_bench_running = 0;
+static volatile uint32_t smp_bench_sink = 0;
+
+static void smp_bench_worker(void) {
+    uint32_t x = smp_bench_running;
+    for (uint32_t i = 0; i < SMP_BENCH_ROUNDS; i++) {
+        x = x * 1103515245 + 12345;
+    }
+    __sync_fetch_and_add(&smp_bench_sink, x);
+    __sync_fetch_and_sub(&smp_bench_running, 1);
+}
+
+/* Wall clock ticks until all threads are done, 0 if they could not start */
+static uint32_t smp_bench_run(uint32_t threads) {
+    smp_bench_running = threads;
+    uint32_t start = timer_get_ticks();
+    for (uint32_t i = 0; i < threads; i++) {
+        if (!kthread_create("smpbench", smp_bench_worker, 1)) {
+            __sync_fetch_and_sub(&smp_bench_running, threads - i);
+            while (smp_bench_running) process_sleep(10);
+            return 0;
+        }
+    }
+    
+    while (smp_bench_running) {
+        process_sleep(10);
+    }
+    return timer_get_ticks() - start;
+}
+
+void smp_benchmark(uint32_t threads) {
+    if (threads == 0) threads = smp_cpu_count;
+    
+    uint32_t single = smp_bench_run(1);
+    uint32_t parallel = smp_bench_run(threads);
+    if (!single || !parallel) {
+        vga_puts("smpbench: cannot create threads\n");
+        return;
+    }
+    
+    /* threads times the work in parallel time, against one unit of work */
+    uint32_t speedup = threads * single * 100 / parallel;
+    vga_printf("1 thread:   %u ms\n", single * 1000 / TIMER_FREQUENCY);
+    vga_printf("%u threads: %u ms on %u CPUs\n", threads,
+               parallel * 1000 / TIMER_FREQUENCY, smp_cpu_count);
+    vga_printf("Speedup:    %u.%u%ux\n", speedup / 100, (speedup / 10) % 10, speedup % 10);
+}
\ No newline at end of file
@@ -0,0 +1,144 @@
+#include "softirq.h"
+#include "process.h"
+#include "kernel.h"
+#include "vga.h"
+#include "cpu.h"
+#include "smp.h"
+
+static void (*softirq_handlers[SOFTIRQ_COUNT])(void);
+static const char* softirq_names[SOFTIRQ_COUNT] = { "timer", "keyboard" };
+/* Pending bits and the running flag are per CPU (cpu_t). Device interrupts
+ * all arrive on the BSP, which is where ksoftirqd lives. */
+static uint32_t softirq_counts[SOFTIRQ_COUNT];
+static uint32_t softirq_deferred = 0;   /* Times ksoftirqd had to take over */
+static process_t* ksoftirqd = NULL;
+
+static work_t* work_head = NULL;
+static work_t* work_tail = NULL;
+static uint32_t work_done = 0;
+static process_t* kworker = NULL;
+
+void softirq_register(uint32_t nr, void (*handler)(void)) {
+    if (nr < SOFTIRQ_COUNT) softirq_handlers[nr] = handler;
+}
+
+void softirq_raise(uint32_t nr) {
+    uint32_t flags = irq_save();
+    this_cpu()->softirq_pending |= 1u << nr;
+    irq_restore(flags);
+}
+
+/* Run pending softirqs with interrupts enabled. An interrupt arriving in the
+ * middle only raises more bits, which the loop picks up. Work that keeps
+ * coming back is left to ksoftirqd so tasks still get the CPU. */
+void softirq_run(void) {
+    uint32_t flags = irq_save();
+    cpu_t* cpu = this_cpu();
+    if (cpu->softirq_active || !cpu->softirq_pending) {
+        irq_restore(flags);
+        return;
+    }
+    
+    cpu->softirq_active = 1;
+    for (uint32_t round = 0; cpu->softirq_pending && round < SOFTIRQ_MAX_RESTART; round++) {
+        uint32_t pending = cpu->softirq_pending;
+        cpu->softirq_pending = 0;
+        
+        __asm__ volatile ("sti");
+        while (pending) {
+            uint32_t nr = __builtin_ctz(pending);
+            pending &= pending - 1;
+            softirq_counts[nr]++;
+            if (softirq_handlers[nr]) softirq_handlers[nr]();
+        }
+        __asm__ volatile ("cli");
+    }
+    cpu->softirq_active = 0;
+    
+    if (cpu->softirq_pending && ksoftirqd) {
+        softirq_deferred++;
+        process_wake(ksoftirqd);
+    }
+    irq_restore(flags);
+}
+
+/* Tail of every hardware interrupt: bottom halves, then a pending
+ * preemption. An interrupt nested inside a softirq does neither. */
+void irq_exit(void) {
+    if (this_cpu()->softirq_active) return;
+    softirq_run();
+    scheduler_preempt();
+}
+
+static void ksoftirqd_main(void) {
+    while (1) {
+        softirq_run();
+        
+        uint32_t flags = irq_save();
+        if (!this_cpu()->softirq_pending) process_block();
+        irq_restore(flags);
+    }
+}
+
+void work_init(work_t* work, void (*func)(void* data), void* data) {
+    work->func = func;
+    work->data = data;
+    work->pending = 0;
+    work->next = NULL;
+}
+
+/* Queue work for kworker; already queued work is not added twice */
+void work_queue(work_t* work) {
+    uint32_t flags = irq_save();
+    if (!work->pending) {
+        work->pending = 1;
+        work->next = NULL;
+        if (work_tail) work_tail->next = work;
+        else work_head = work;
+        work_tail = work;
+        if (kworker) process_wake(kworker);
+    }
+    irq_restore(flags);
+}
+
+static void kworker_main(void) {
+    while (1) {
+        uint32_t flags = irq_save();
+        work_t* work = work_head;
+        if (!work) {
+            process_block();
+            irq_restore(flags);
+            continue;
+        }
+        
+        work_head = work->next;
+        if (!work_head) work_tail = NULL;
+        work->pending = 0;
+        irq_restore(flags);
+        
+        /* Cleared first, so the work may queue itself again */
+        work->func(work->data);
+        work_done++;
+    }
+}
+
+/* Start the threads that take over from interrupt exit */
+void softirq_init(void) {
+    ksoftirqd = process_get_by_pid(kthread_create("ksoftirqd", ksoftirqd_main,
+                                                  SOFTIRQ_THREAD_PRIORITY));
+    kworker = process_get_by_pid(kthread_create("kworker", kworker_main,
+                                                SOFTIRQ_THREAD_PRIORITY));
+    if (!ksoftirqd || !kworker) kernel_panic("Cannot create softirq threads");
+    
+    /* It takes over this CPU's pending bits, so it has to run here */
+    process_pin(ksoftirqd);
+}
+
+void softirq_info(void) {
+    vga_puts("Softirq     Runs\n");
+    for (uint32_t i = 0; i < SOFTIRQ_COUNT; i++) {
+        vga_printf("%-10s  %u\n", softirq_names[i], softirq_counts[i]);
+    }
+    vga_printf("Deferred to ksoftirqd: %u, work items run: %u\n",
+               softirq_deferred, work_done);
+}
\ No newline at end of file
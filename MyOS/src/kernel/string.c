@@ -51,4 +51,15 @@ void* memcpy(void* dest, const void* src, size_t size) {
         *d++ = *s++;
     }
     return dest;
-}
\ No newline at end of file
+}
+
+int memcmp(const void* ptr1, const void* ptr2, size_t size) {
+    const unsigned char* a = (const unsigned char*)ptr1;
+    const unsigned char* b = (const unsigned char*)ptr2;
+    while (size--) {
+        if (*a != *b) return *a - *b;
+        a++;
+        b++;
+    }
+    return 0;
+}
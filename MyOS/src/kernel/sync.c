@@ -0,0 +1,441 @@
+#include "sync.h"
+#include "process.h"
+#include "kernel.h"
+#include "vga.h"
+#include "cpu.h"
+#include "smp.h"
+#include "timer.h"
+
+/*
+ * Every queue and lock word is protected by irq_save(), which on SMP also
+ * holds the big kernel lock. A sleeper keeps that lock held from the check
+ * of its condition until schedule() has switched it out, so a wake-up can
+ * never slip in between and be lost.
+ */
+
+static lock_stat_t* lock_stats = NULL;
+
+static void lock_stat_init(lock_stat_t* stat, const char* name, const char* type) {
+    memset(stat, 0, sizeof(*stat));
+    stat->name = name;
+    stat->type = type;
+    if (!name) return;
+    
+    uint32_t flags = irq_save();
+    stat->next = lock_stats;
+    lock_stats = stat;
+    irq_restore(flags);
+}
+
+static void lock_stat_wait(lock_stat_t* stat, uint64_t start, int spun) {
+    uint32_t us = timer_tsc_to_us(rdtsc() - start);
+    stat->contended++;
+    stat->spun += spun;
+    stat->wait_us = us > 0xFFFFFFFF - stat->wait_us ? 0xFFFFFFFF : stat->wait_us + us;
+    if (us > stat->max_wait_us) stat->max_wait_us = us;
+}
+
+/* Wait queues */
+
+void wait_queue_init(wait_queue_t* queue) {
+    queue->head = NULL;
+}
+
+static void wait_queue_insert(wait_queue_t* queue, process_t* proc) {
+    process_t** link = &queue->head;
+    while (*link && (*link)->priority >= proc->priority) {
+        link = &(*link)->wait_next;
+    }
+    proc->wait_next = *link;
+    *link = proc;
+    proc->waiting_on = queue;
+}
+
+static void wait_queue_remove(wait_queue_t* queue, process_t* proc) {
+    for (process_t** link = &queue->head; *link; link = &(*link)->wait_next) {
+        if (*link == proc) {
+            *link = proc->wait_next;
+            break;
+        }
+    }
+    proc->wait_next = NULL;
+    proc->waiting_on = NULL;
+}
+
+/* Block the current task until it is woken through the queue. Returns 1
+ * when a wake_up took it off the queue, 0 when something else woke it. */
+int wait_queue_sleep(wait_queue_t* queue) {
+    process_t* self = process_get_current();
+    uint32_t flags = irq_save();
+    wait_queue_insert(queue, self);
+    process_block();
+    
+    int woken = self->waiting_on != queue;
+    if (!woken) wait_queue_remove(queue, self);
+    irq_restore(flags);
+    return woken;
+}
+
+process_t* wake_up_one(wait_queue_t* queue) {
+    uint32_t flags = irq_save();
+    process_t* proc = queue->head;
+    if (proc) {
+        wait_queue_remove(queue, proc);
+        process_wake(proc);
+    }
+    irq_restore(flags);
+    return proc;
+}
+
+void wake_up_all(wait_queue_t* queue) {
+    uint32_t flags = irq_save();
+    while (queue->head) {
+        wake_up_one(queue);
+    }
+    irq_restore(flags);
+}
+
+/* Priority inheritance */
+
+/* Scheduling priority changed: keep the wait queue it sleeps on sorted */
+static void sync_set_priority(process_t* proc, uint32_t priority) {
+    process_set_priority(proc, priority);
+    wait_queue_t* queue = proc->waiting_on;
+    if (queue) {
+        wait_queue_remove(queue, proc);
+        wait_queue_insert(queue, proc);
+    }
+}
+
+/* Lend priority to the owner of a mutex, and on down the chain of owners
+ * it is itself blocked behind */
+static void mutex_boost(mutex_t* mutex, uint32_t priority) {
+    for (int depth = 0; mutex && depth < MUTEX_PI_DEPTH; depth++) {
+        process_t* owner = mutex->owner;
+        if (!owner || owner->priority >= priority) return;
+        sync_set_priority(owner, priority);
+        mutex = owner->blocked_on;
+    }
+}
+
+/* Back to the base priority, or the best one still waiting for a mutex the
+ * task holds. Waiter queues are sorted, so their heads are enough. */
+static void mutex_unboost(process_t* proc) {
+    uint32_t priority = proc->base_priority;
+    for (mutex_t* held = proc->held_mutexes; held; held = held->held_next) {
+        process_t* waiter = held->waiters.head;
+        if (waiter && waiter->priority > priority) priority = waiter->priority;
+    }
+    if (priority != proc->priority) sync_set_priority(proc, priority);
+}
+
+/* Mutexes */
+
+void mutex_init(mutex_t* mutex, const char* name) {
+    mutex->owner = NULL;
+    mutex->owner_cpu = 0;
+    mutex->held_next = NULL;
+    wait_queue_init(&mutex->waiters);
+    lock_stat_init(&mutex->stat, name, "mutex");
+}
+
+static void mutex_take(mutex_t* mutex, process_t* owner) {
+    mutex->owner = owner;
+    mutex->owner_cpu = owner->cpu;
+    mutex->held_next = owner->held_mutexes;
+    owner->held_mutexes = mutex;
+    mutex->stat.acquisitions++;
+}
+
+/* Whether the owner is on another CPU right now. Only cpus[] is read, the
+ * owner may have let go and exited already. */
+static int mutex_owner_running(mutex_t* mutex, process_t* owner) {
+    uint32_t cpu = mutex->owner_cpu;
+    return smp_active && cpu != this_cpu()->id && cpus[cpu].current == owner;
+}
+
+int mutex_trylock(mutex_t* mutex) {
+    uint32_t flags = irq_save();
+    int taken = !mutex->owner;
+    if (taken) mutex_take(mutex, process_get_current());
+    irq_restore(flags);
+    return taken;
+}
+
+void mutex_lock(mutex_t* mutex) {
+    process_t* self = process_get_current();
+    uint32_t flags = irq_save();
+    if (!mutex->owner) {
+        mutex_take(mutex, self);
+        irq_restore(flags);
+        return;
+    }
+    if (mutex->owner == self) kernel_panic("mutex_lock: already the owner");
+    uint64_t start = rdtsc();
+    
+    /* An owner running on another CPU usually lets go within a few
+     * microseconds, much less than two context switches cost. Spin without
+     * the kernel lock so it can. */
+    process_t* owner = mutex->owner;
+    if (mutex_owner_running(mutex, owner)) {
+        irq_restore(flags);
+        for (uint32_t spins = 0; spins < MUTEX_SPIN_LIMIT; spins++) {
+            if (mutex->owner != owner || !mutex_owner_running(mutex, owner)) break;
+            cpu_relax();
+        }
+        flags = irq_save();
+        if (!mutex->owner) {
+            mutex_take(mutex, self);
+            lock_stat_wait(&mutex->stat, start, 1);
+            irq_restore(flags);
+            return;
+        }
+    }
+    
+    /* Block. mutex_unlock() makes the first waiter the owner before waking
+     * it, so there is nothing to retry once it is ours. */
+    self->blocked_on = mutex;
+    mutex_boost(mutex, self->priority);
+    while (mutex->owner != self) {
+        wait_queue_sleep(&mutex->waiters);
+    }
+    self->blocked_on = NULL;
+    lock_stat_wait(&mutex->stat, start, 0);
+    irq_restore(flags);
+}
+
+/* Let go of a mutex the current task owns and hand it to the best waiter,
+ * which then inherits the priorities of the ones left behind it. Returns
+ * the new owner, if any. */
+static process_t* mutex_release(mutex_t* mutex) {
+    process_t* self = process_get_current();
+    if (mutex->owner != self) kernel_panic("mutex_unlock: not the owner");
+    
+    for (mutex_t** link = &self->held_mutexes; *link; link = &(*link)->held_next) {
+        if (*link == mutex) {
+            *link = mutex->held_next;
+            break;
+        }
+    }
+    mutex->held_next = NULL;
+    mutex->owner = NULL;
+    
+    process_t* next = mutex->waiters.head;
+    if (next) {
+        wait_queue_remove(&mutex->waiters, next);
+        mutex_take(mutex, next);
+        if (mutex->waiters.head) mutex_boost(mutex, mutex->waiters.head->priority);
+        process_wake(next);
+    }
+    mutex_unboost(self);
+    return next;
+}
+
+void mutex_unlock(mutex_t* mutex) {
+    uint32_t flags = irq_save();
+    process_t* next = mutex_release(mutex);
+    irq_restore(flags);
+    
+    /* A lent priority is gone; let a more important new owner run now */
+    process_t* self = process_get_current();
+    if (next && next->cpu == self->cpu && next->priority > self->priority) {
+        process_yield();
+    }
+}
+
+/* Semaphores */
+
+void sem_init(semaphore_t* sem, int32_t count, const char* name) {
+    sem->count = count;
+    wait_queue_init(&sem->waiters);
+    lock_stat_init(&sem->stat, name, "semaphore");
+}
+
+int sem_trydown(semaphore_t* sem) {
+    uint32_t flags = irq_save();
+    int taken = sem->count > 0;
+    if (taken) {
+        sem->count--;
+        sem->stat.acquisitions++;
+    }
+    irq_restore(flags);
+    return taken;
+}
+
+void sem_down(semaphore_t* sem) {
+    uint32_t flags = irq_save();
+    sem->stat.acquisitions++;
+    if (sem->count > 0) {
+        sem->count--;
+        irq_restore(flags);
+        return;
+    }
+    
+    /* sem_up() passes its unit straight to the waiter it wakes */
+    uint64_t start = rdtsc();
+    while (!wait_queue_sleep(&sem->waiters)) {
+        /* Woken by something else, no unit was passed */
+    }
+    lock_stat_wait(&sem->stat, start, 0);
+    irq_restore(flags);
+}
+
+void sem_up(semaphore_t* sem) {
+    uint32_t flags = irq_save();
+    if (!wake_up_one(&sem->waiters)) sem->count++;
+    irq_restore(flags);
+}
+
+/* Condition variables */
+
+void cond_init(condvar_t* cond) {
+    wait_queue_init(&cond->waiters);
+}
+
+/* Atomically release the mutex and sleep, then take the mutex back. Callers
+ * recheck their condition, a broadcast wakes everyone. */
+void cond_wait(condvar_t* cond, mutex_t* mutex) {
+    uint32_t flags = irq_save();
+    mutex_release(mutex);
+    wait_queue_sleep(&cond->waiters);
+    irq_restore(flags);
+    mutex_lock(mutex);
+}
+
+void cond_signal(condvar_t* cond) {
+    wake_up_one(&cond->waiters);
+}
+
+void cond_broadcast(condvar_t* cond) {
+    wake_up_all(&cond->waiters);
+}
+
+void sync_info(void) {
+    vga_puts("Lock            Type       Acquired  Contended  Spun   Wait us   Max us\n");
+    uint32_t flags = irq_save();
+    for (lock_stat_t* stat = lock_stats; stat; stat = stat->next) {
+        vga_printf("%-14s  %-9s  %-8u  %-9u  %-5u  %-8u  %u\n", stat->name, stat->type,
+                   stat->acquisitions, stat->contended, stat->spun,
+                   stat->wait_us, stat->max_wait_us);
+    }
+    irq_restore(flags);
+}
+
+/* Contention benchmark: workers hammer one mutex, yielding inside the
+ * critical section so the others block, then a bounded buffer is pushed
+ * through by a producer and consumers. Completion is counted on a
+ * semaphore, so the shell sleeps instead of polling. */
+#define SYNC_BENCH_WORKERS  4
+#define SYNC_BENCH_ROUNDS   2000
+#define SYNC_BENCH_ITEMS    1000
+#define SYNC_BENCH_SLOTS    8
+
+static mutex_t bench_mutex;
+static semaphore_t bench_done;
+static semaphore_t bench_free;
+static semaphore_t bench_full;
+static condvar_t bench_cond;
+static uint32_t bench_counter;
+static uint32_t bench_ring[SYNC_BENCH_SLOTS];
+static uint32_t bench_head;
+static uint32_t bench_tail;
+static uint32_t bench_sum;
+static uint32_t bench_consumed;
+static int bench_ready;
+
+static void sync_bench_locker(void) {
+    for (uint32_t i = 0; i < SYNC_BENCH_ROUNDS; i++) {
+        mutex_lock(&bench_mutex);
+        uint32_t value = bench_counter;
+        if ((i & 63) == 0) process_yield();
+        bench_counter = value + 1;
+        mutex_unlock(&bench_mutex);
+    }
+    sem_up(&bench_done);
+}
+
+static void sync_bench_producer(void) {
+    /* Starts when the shell says so, through the condition variable */
+    mutex_lock(&bench_mutex);
+    while (!bench_ready) cond_wait(&bench_cond, &bench_mutex);
+    mutex_unlock(&bench_mutex);
+    
+    for (uint32_t item = 1; item <= SYNC_BENCH_ITEMS; item++) {
+        sem_down(&bench_free);
+        mutex_lock(&bench_mutex);
+        bench_ring[bench_head++ % SYNC_BENCH_SLOTS] = item;
+        mutex_unlock(&bench_mutex);
+        sem_up(&bench_full);
+    }
+    sem_up(&bench_done);
+}
+
+static void sync_bench_consumer(void) {
+    while (1) {
+        sem_down(&bench_full);
+        mutex_lock(&bench_mutex);
+        uint32_t item = bench_ring[bench_tail++ % SYNC_BENCH_SLOTS];
+        if (item) {
+            bench_sum += item;
+            bench_consumed++;
+        }
+        mutex_unlock(&bench_mutex);
+        sem_up(&bench_free);
+        if (!item) break;   /* End marker */
+    }
+    sem_up(&bench_done);
+}
+
+void sync_benchmark(void) {
+    static int initialized = 0;
+    if (!initialized) {
+        mutex_init(&bench_mutex, "bench");
+        sem_init(&bench_done, 0, NULL);
+        sem_init(&bench_free, SYNC_BENCH_SLOTS, "bench-free");
+        sem_init(&bench_full, 0, "bench-full");
+        cond_init(&bench_cond);
+        initialized = 1;
+    }
+    
+    bench_counter = 0;
+    uint32_t start = timer_get_ticks();
+    uint32_t started = 0;
+    for (uint32_t i = 0; i < SYNC_BENCH_WORKERS; i++) {
+        if (kthread_create("syncbench", sync_bench_locker, 1)) started++;
+    }
+    for (uint32_t i = 0; i < started; i++) sem_down(&bench_done);
+    vga_printf("Mutex:     %u/%u increments in %u ms\n", bench_counter,
+               started * SYNC_BENCH_ROUNDS,
+               (timer_get_ticks() - start) * 1000 / TIMER_FREQUENCY);
+    
+    bench_head = bench_tail = bench_sum = bench_consumed = 0;
+    bench_ready = 0;
+    start = timer_get_ticks();
+    uint32_t consumers = 0;
+    for (uint32_t i = 0; i < SYNC_BENCH_WORKERS - 1; i++) {
+        if (kthread_create("consumer", sync_bench_consumer, 1)) consumers++;
+    }
+    if (!kthread_create("producer", sync_bench_producer, 1)) {
+        vga_puts("syncbench: cannot create the producer\n");
+        bench_ready = 1;
+    } else {
+        mutex_lock(&bench_mutex);
+        bench_ready = 1;
+        cond_broadcast(&bench_cond);
+        mutex_unlock(&bench_mutex);
+        sem_down(&bench_done);
+    }
+    
+    /* One end marker per consumer */
+    for (uint32_t i = 0; i < consumers; i++) {
+        sem_down(&bench_free);
+        mutex_lock(&bench_mutex);
+        bench_ring[bench_head++ % SYNC_BENCH_SLOTS] = 0;
+        mutex_unlock(&bench_mutex);
+        sem_up(&bench_full);
+    }
+    for (uint32_t i = 0; i < consumers; i++) sem_down(&bench_done);
+    vga_printf("Semaphore: %u items (sum %u) through %u slots in %u ms\n",
+               bench_consumed, bench_sum, SYNC_BENCH_SLOTS,
+               (timer_get_ticks() - start) * 1000 / TIMER_FREQUENCY);
+}
\ No newline at end of file
@@ -0,0 +1,232 @@
+#include "syscall.h"
+#include "process.h"
+#include "interrupts.h"
+#include "memory.h"
+#include "kernel.h"
+#include "vga.h"
+#include "cpu.h"
+#include "tss.h"
+#include "timer.h"
+
+/* SYSENTER model specific registers */
+#define MSR_SYSENTER_CS     0x174
+#define MSR_SYSENTER_ESP    0x175
+#define MSR_SYSENTER_EIP    0x176
+
+#define CPUID_EDX_SEP       0x00000800
+
+typedef uint32_t (*syscall_fn_t)(uint32_t arg1, uint32_t arg2, uint32_t arg3);
+
+static int sysenter_present = 0;
+
+/* syscall_entry.asm pushes exactly this much */
+_Static_assert(sizeof(syscall_frame_t) == 15 * 4, "syscall_entry.asm frame");
+
+/* Whether the caller may read first..last, all within one page: it is
+ * mapped for user mode, or reserved as stack or heap, which the page fault
+ * handler backs on first touch from the kernel as well */
+static int user_page_ok(process_t* proc, uint32_t first, uint32_t last) {
+    page_table_entry_t* entry = get_page_entry(NULL, first, 0);
+    if (entry && entry->present) return entry->user;
+    
+    if (first >= proc->stack_base && last < proc->stack_base + USER_STACK_SIZE) return 1;
+    return first >= proc->heap_start && last < proc->heap_end;
+}
+
+/* A user buffer must lie below the kernel, in memory the caller can read.
+ * Anything else would fault in kernel mode. */
+static int user_range_ok(uint32_t addr, uint32_t size) {
+    if (addr >= KERNEL_VIRTUAL_BASE || size > KERNEL_VIRTUAL_BASE - addr) return 0;
+    
+    process_t* proc = process_get_current();
+    uint32_t end = addr + size;
+    while (addr < end) {
+        uint32_t page_end = (addr & ~(PAGE_SIZE - 1)) + PAGE_SIZE;
+        uint32_t last = (end < page_end ? end : page_end) - 1;
+        if (!user_page_ok(proc, addr, last)) return 0;
+        addr = last + 1;
+    }
+    return 1;
+}
+
+static uint32_t sys_exit(uint32_t code, uint32_t arg2, uint32_t arg3) {
+    (void)arg2; (void)arg3;
+    process_exit(code);
+    return 0;
+}
+
+/* The frame both entry paths leave at the top of the caller's kernel stack */
+static syscall_frame_t* syscall_frame(void) {
+    process_t* proc = process_get_current();
+    return (syscall_frame_t*)(proc->kernel_stack + STACK_SIZE) - 1;
+}
+
+static uint32_t sys_fork(uint32_t arg1, uint32_t arg2, uint32_t arg3) {
+    (void)arg1; (void)arg2; (void)arg3;
+    return process_fork(syscall_frame());
+}
+
+/* Only the console (fd 1) exists so far */
+static uint32_t sys_write(uint32_t fd, uint32_t buffer, uint32_t count) {
+    if (fd != 1 || !user_range_ok(buffer, count)) return (uint32_t)-1;
+    
+    const char* str = (const char*)buffer;
+    for (uint32_t i = 0; i < count; i++) {
+        vga_putchar(str[i]);
+    }
+    return count;
+}
+
+static uint32_t sys_getpid(uint32_t arg1, uint32_t arg2, uint32_t arg3) {
+    (void)arg1; (void)arg2; (void)arg3;
+    process_t* proc = process_get_current();
+    return proc ? proc->pid : 0;
+}
+
+static uint32_t sys_sleep(uint32_t ms, uint32_t arg2, uint32_t arg3) {
+    (void)arg2; (void)arg3;
+    process_sleep(ms);
+    return 0;
+}
+
+static uint32_t sys_sbrk(uint32_t increment, uint32_t arg2, uint32_t arg3) {
+    (void)arg2; (void)arg3;
+    return process_sbrk((int32_t)increment);
+}
+
+/* Indexed by number; empty slots are unknown calls */
+static const syscall_fn_t syscall_table[SYSCALL_COUNT] = {
+    [SYS_EXIT]   = sys_exit,
+    [SYS_FORK]   = sys_fork,
+    [SYS_WRITE]  = sys_write,
+    [SYS_GETPID] = sys_getpid,
+    [SYS_SLEEP]  = sys_sleep,
+    [SYS_SBRK]   = sys_sbrk,
+};
+
+/* Common dispatcher behind both entry paths, with interrupts enabled */
+uint32_t syscall_handler(uint32_t syscall_num, uint32_t arg1, uint32_t arg2, uint32_t arg3) {
+    if (syscall_num >= SYSCALL_COUNT || !syscall_table[syscall_num]) {
+        return (uint32_t)-1;
+    }
+    return syscall_table[syscall_num](arg1, arg2, arg3);
+}
+
+/* SYSENTER loads ESP from an MSR that cannot follow the running task, so it
+ * points at this CPU's tss.esp0 and the entry stub loads the stack from
+ * there. Every CPU programs its own. */
+void syscall_init_cpu(void) {
+    if (!sysenter_present) return;
+    
+    wrmsr(MSR_SYSENTER_CS, KERNEL_CODE_SEGMENT);
+    wrmsr(MSR_SYSENTER_ESP, (uint32_t)&tss_current()->esp0);
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t)syscall_sysenter);
+}
+
+void syscall_init(void) {
+    /* DPL 3 so user mode may raise it; an interrupt gate, the stub enables
+     * interrupts once GS is valid */
+    idt_set_gate(SYSCALL_VECTOR, (uint32_t)syscall_int80, KERNEL_CODE_SEGMENT, 0xEE);
+    
+    uint32_t eax, ebx, ecx, edx;
+    __asm__ volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    sysenter_present = (edx & CPUID_EDX_SEP) != 0;
+    syscall_init_cpu();
+    
+    vga_printf("System calls: int 0x%x%s\n", SYSCALL_VECTOR,
+               sysenter_present ? " and sysenter" : "");
+}
+
+/* Null system call round trip through each entry path, and the same answer
+ * read from the vDSO pages without trapping, timed from user mode by the
+ * code between syscall_bench_start and syscall_bench_end. It runs in a
+ * process of its own and leaves its results in the page, which the
+ * benchmark keeps a reference to. */
+typedef struct syscall_bench_data {
+    uint32_t int80_rounds;
+    uint32_t sysenter_rounds;   /* 0 skips the sysenter loop */
+    uint32_t vdso_rounds;
+    uint32_t syscall_pid;       /* What SYS_GETPID returned */
+    uint64_t start;             /* Scratch */
+    uint64_t int80_cycles;
+    uint64_t sysenter_cycles;
+    uint64_t vdso_cycles;
+    uint32_t vdso_pid;          /* What the task page said */
+    uint32_t vdso_us;           /* Last clock read, low 32 bits */
+    volatile uint32_t done;
+} syscall_bench_data_t;         /* Offsets used by syscall_entry.asm */
+
+extern uint8_t syscall_bench_start[];
+extern uint8_t syscall_bench_end[];
+
+static uint32_t syscall_bench_frame = 0;
+
+static void syscall_bench_main(void) {
+    if (!map_page(SYSCALL_BENCH_ADDR, syscall_bench_frame, PAGE_PRESENT | PAGE_WRITE | PAGE_USER)) {
+        page_unref(syscall_bench_frame);
+        process_exit(1);
+    }
+    enter_user_mode(SYSCALL_BENCH_ADDR, USER_STACK_TOP);
+}
+
+static uint32_t syscall_bench_per_call(uint64_t cycles, uint32_t rounds) {
+    if (cycles >> 32) return 0xFFFFFFFF;
+    return (uint32_t)cycles / rounds;
+}
+
+void syscall_benchmark(void) {
+    uint32_t frame = alloc_page();
+    if (!frame) {
+        vga_puts("syscallbench: out of memory\n");
+        return;
+    }
+    
+    uint8_t* page = PHYS_TO_VIRT(frame);
+    memset(page, 0, PAGE_SIZE);
+    memcpy(page, syscall_bench_start, syscall_bench_end - syscall_bench_start);
+    syscall_bench_data_t* data = (syscall_bench_data_t*)(page + SYSCALL_BENCH_DATA);
+    data->int80_rounds = SYSCALL_BENCH_ROUNDS;
+    data->sysenter_rounds = sysenter_present ? SYSCALL_BENCH_ROUNDS : 0;
+    data->vdso_rounds = SYSCALL_BENCH_ROUNDS;
+    
+    /* The process's mapping holds the second reference */
+    page_ref(frame);
+    syscall_bench_frame = frame;
+    if (!process_create("syscallbench", syscall_bench_main, 1)) {
+        page_unref(frame);
+        page_unref(frame);
+        vga_puts("syscallbench: cannot create the process\n");
+        return;
+    }
+    
+    for (uint32_t waited = 0; !data->done && waited < 5000; waited += 10) {
+        process_sleep(10);
+    }
+    
+    if (!data->done) {
+        vga_puts("syscallbench: no result\n");
+    } else {
+        uint32_t int80 = syscall_bench_per_call(data->int80_cycles, data->int80_rounds);
+        vga_printf("int 0x80:  %u cycles per null call\n", int80);
+        if (data->sysenter_rounds) {
+            uint32_t sysenter = syscall_bench_per_call(data->sysenter_cycles,
+                                                       data->sysenter_rounds);
+            uint32_t speedup = sysenter ? int80 * 100 / sysenter : 0;
+            vga_printf("sysenter:  %u cycles per null call (%u.%u%ux speedup)\n", sysenter,
+                       speedup / 100, (speedup / 10) % 10, speedup % 10);
+        } else {
+            vga_puts("sysenter:  not supported by this CPU\n");
+        }
+        uint32_t vdso = syscall_bench_per_call(data->vdso_cycles, data->vdso_rounds);
+        uint32_t speedup = vdso ? int80 * 100 / vdso : 0;
+        vga_printf("vDSO:      %u cycles per getpid + clock read (%u.%u%ux speedup)\n", vdso,
+                   speedup / 100, (speedup / 10) % 10, speedup % 10);
+        vga_printf("           pid %u (syscall said %u), clock at %u us\n",
+                   data->vdso_pid, data->syscall_pid, data->vdso_us);
+    }
+    
+    /* A late process keeps its own reference until it exits */
+    uint32_t flags = irq_save();
+    page_unref(frame);
+    irq_restore(flags);
+}
\ No newline at end of file
@@ -3,77 +3,331 @@
 #include "vga.h"
 #include "interrupts.h"
 #include "process.h"
+#include "cmdline.h"
+#include "cpu.h"
+#include "softirq.h"
+#include "smp.h"
+#include "vdso.h"
+#include "apic.h"
 
 static volatile uint32_t timer_ticks = 0;
+static uint32_t timer_ticks_done = 0;   /* Ticks the bottom half has processed */
 static system_time_t system_time = {0, 0, 12, 1, 1, 2024}; /* Default: Jan 1, 2024 12:00:00 */
 
+/* Dynamic tick: while the idle task halts, the PIT is programmed one-shot
+ * for the next timer deadline and the ticks that passed are recovered from
+ * the TSC when the CPU wakes up */
+static int timer_nohz = 1;
+static volatile int timer_oneshot = 0;
+static uint32_t oneshot_deadline = 0;   /* Tick the armed one-shot fires at */
+static uint32_t tsc_per_tick = 0;
+static uint64_t tick_tsc = 0;           /* TSC at the last accounted tick */
+static uint32_t timer_interrupts = 0;
+static uint32_t nohz_entries = 0;
+static uint32_t nohz_skipped = 0;       /* Ticks accounted without an interrupt */
+static uint32_t nohz_kicks = 0;         /* One-shots cut short for an earlier event */
+
+/* An AP has no deadlines of its own: the wheel runs on the BSP and work
+ * reaches the AP by IPI. Idle, its APIC tick would only account idle time,
+ * so it is stopped but for one interrupt a second. */
+#define AP_IDLE_TICKS TIMER_FREQUENCY
+
+static void timer_softirq(void);
+
+static void timer_set_periodic(void) {
+    outb(0x43, 0x36); /* Channel 0, lobyte/hibyte, rate generator */
+    outb(0x40, PIT_TICK_COUNT & 0xFF);        /* Low byte */
+    outb(0x40, (PIT_TICK_COUNT >> 8) & 0xFF); /* High byte */
+}
+
+static void timer_set_oneshot(uint32_t count) {
+    outb(0x43, 0x30); /* Channel 0, lobyte/hibyte, interrupt on terminal count */
+    outb(0x40, count & 0xFF);
+    outb(0x40, (count >> 8) & 0xFF);
+}
+
+/* Count TSC cycles across 10ms of PIT channel 2. Returns cycles per tick,
+ * or 0 if the channel never reached terminal count. */
+static uint32_t timer_calibrate_tsc(void) {
+    uint32_t count = PIT_FREQUENCY / 100;
+    
+    /* Gate low with the speaker off, load the count, then start it */
+    outb(0x61, inb(0x61) & ~0x03);
+    outb(0x43, 0xB0); /* Channel 2, lobyte/hibyte, interrupt on terminal count */
+    outb(0x42, count & 0xFF);
+    outb(0x42, (count >> 8) & 0xFF);
+    outb(0x61, inb(0x61) | 0x01);
+    
+    uint64_t start = rdtsc();
+    for (uint32_t spins = 0; !(inb(0x61) & 0x20); spins++) {
+        if (spins > 0x1000000) return 0;
+    }
+    uint64_t cycles = rdtsc() - start;
+    
+    outb(0x61, inb(0x61) & ~0x01);
+    if (cycles >> 32) return 0;
+    return (uint32_t)cycles / (TIMER_FREQUENCY / 100);
+}
+
 void timer_init(void) {
-    /* Calculate divisor for desired frequency */
-    uint32_t divisor = PIT_FREQUENCY / TIMER_FREQUENCY;
+    /* nohz=off keeps the periodic tick even when idle */
+    const char* nohz = cmdline_get("nohz");
+    if (nohz && strcmp(nohz, "off") == 0) {
+        timer_nohz = 0;
+    }
     
-    /* Send command byte */
-    outb(0x43, 0x36); /* Channel 0, lobyte/hibyte, rate generator */
+    /* Also needed for timer_udelay() */
+    tsc_per_tick = timer_calibrate_tsc();
+    if (!tsc_per_tick) timer_nohz = 0;
     
-    /* Send divisor */
-    outb(0x40, divisor & 0xFF);        /* Low byte */
-    outb(0x40, (divisor >> 8) & 0xFF); /* High byte */
+    softirq_register(SOFTIRQ_TIMER, timer_softirq);
+    tick_tsc = rdtsc();
+    timer_set_periodic();
     
-    vga_printf("Timer initialized at %d Hz\n", TIMER_FREQUENCY);
+    vga_printf("Timer initialized at %d Hz", TIMER_FREQUENCY);
+    if (timer_nohz) {
+        vga_printf(", tickless idle (TSC %u kHz)\n", tsc_per_tick);
+    } else {
+        vga_puts("\n");
+    }
 }
 
-void timer_handler(void) {
-    timer_ticks++;
+static void timer_second(void) {
+    system_time.seconds++;
     
-    /* Update system time every second (1000 ticks) */
-    if (timer_ticks % TIMER_FREQUENCY == 0) {
-        system_time.seconds++;
+    if (system_time.seconds >= 60) {
+        system_time.seconds = 0;
+        system_time.minutes++;
         
-        if (system_time.seconds >= 60) {
-            system_time.seconds = 0;
-            system_time.minutes++;
+        if (system_time.minutes >= 60) {
+            system_time.minutes = 0;
+            system_time.hours++;
             
-            if (system_time.minutes >= 60) {
-                system_time.minutes = 0;
-                system_time.hours++;
+            if (system_time.hours >= 24) {
+                system_time.hours = 0;
+                system_time.day++;
                 
-                if (system_time.hours >= 24) {
-                    system_time.hours = 0;
-                    system_time.day++;
+                /* Simple month handling (30 days per month) */
+                if (system_time.day > 30) {
+                    system_time.day = 1;
+                    system_time.month++;
                     
-                    /* Simple month handling (30 days per month) */
-                    if (system_time.day > 30) {
-                        system_time.day = 1;
-                        system_time.month++;
-                        
-                        if (system_time.month > 12) {
-                            system_time.month = 1;
-                            system_time.year++;
-                        }
+                    if (system_time.month > 12) {
+                        system_time.month = 1;
+                        system_time.year++;
                     }
                 }
             }
         }
     }
+}
+
+/* Bottom half: catch the calendar, the timer wheel and the scheduler up
+ * with however many ticks the interrupt counted, one or a batch after idle */
+static void timer_softirq(void) {
+    uint32_t now = timer_ticks;
+    uint32_t ticks = now - timer_ticks_done;
+    if (ticks == 0) return;
+    
+    /* Update system time for every second boundary crossed */
+    uint32_t seconds = now / TIMER_FREQUENCY - timer_ticks_done / TIMER_FREQUENCY;
+    timer_ticks_done = now;
+    while (seconds--) {
+        timer_second();
+    }
+    vdso_update(now);
+    
+    /* Expire timers before the scheduler so woken tasks can run this tick */
+    timer_wheel_run(now);
     
     /* Call scheduler */
-    scheduler_tick();
+    scheduler_tick(ticks);
+}
+
+/* Leave one-shot mode: count the whole ticks since the last accounted one
+ * and restart the periodic tick. Interrupts must be off. */
+static uint32_t timer_resume_periodic(void) {
+    uint64_t delta = rdtsc() - tick_tsc;
+    uint32_t ticks = (delta >> 32) ? 0xFFFFFFFF / tsc_per_tick
+                                   : (uint32_t)delta / tsc_per_tick;
+    tick_tsc += (uint64_t)ticks * tsc_per_tick;
+    
+    timer_oneshot = 0;
+    timer_set_periodic();
+    return ticks;
+}
+
+/* Called by the idle task with interrupts off when nothing else can run.
+ * The BSP programs the PIT one-shot for the next wheel deadline, an AP its
+ * APIC timer for AP_IDLE_TICKS. */
+void timer_idle_enter(void) {
+    cpu_t* cpu = this_cpu();
+    if (!timer_nohz) return;
+    
+    if (cpu->id != 0) {
+        if (cpu->timer_oneshot) return;
+        cpu->idle_tsc = rdtsc();
+        cpu->timer_oneshot = 1;
+        apic_timer_oneshot(AP_IDLE_TICKS);
+        uint32_t flags = irq_save();
+        nohz_entries++;
+        irq_restore(flags);
+        return;
+    }
+    if (timer_oneshot) return;
+    
+    /* Under the lock, so an event another CPU adds is either seen here or
+     * sees the one-shot in timer_nohz_kick() */
+    uint32_t flags = irq_save();
+    uint32_t ticks = timer_wheel_next(TIMER_ONESHOT_MAX);
+    if (ticks > 1) {
+        timer_oneshot = 1;
+        oneshot_deadline = timer_ticks + ticks;
+        nohz_entries++;
+        timer_set_oneshot(ticks * PIT_TICK_COUNT);
+    }
+    irq_restore(flags);
+}
+
+/* An event was queued for tick expires. The wheel only runs on the BSP, so
+ * if that is halted on a one-shot firing later, wake it to re-arm for this
+ * one. Called with the lock held. */
+void timer_nohz_kick(uint32_t expires) {
+    if (!timer_oneshot || this_cpu()->id == 0) return;
+    if ((int32_t)(expires - oneshot_deadline) >= 0) return;
+    
+    oneshot_deadline = expires;     /* One IPI per earlier deadline */
+    nohz_kicks++;
+    smp_send_reschedule(0);
+}
+
+/* An AP restarts its periodic tick and charges the idle task with the
+ * ticks it slept through */
+static void timer_idle_exit_ap(cpu_t* cpu) {
+    if (!cpu->timer_oneshot) return;
+    
+    apic_timer_start();
+    cpu->timer_oneshot = 0;
+    uint64_t delta = rdtsc() - cpu->idle_tsc;
+    uint32_t ticks = (delta >> 32) ? 0xFFFFFFFF / tsc_per_tick
+                                   : (uint32_t)delta / tsc_per_tick;
+    if (ticks) {
+        uint32_t flags = irq_save();
+        nohz_skipped += ticks;
+        irq_restore(flags);
+        scheduler_tick(ticks);
+    }
+}
+
+/* Called by the idle task after waking. Another interrupt may have ended
+ * the halt before the one-shot fired; catch up on its behalf. */
+void timer_idle_exit(void) {
+    cpu_t* cpu = this_cpu();
+    if (cpu->id != 0) {
+        timer_idle_exit_ap(cpu);
+        return;
+    }
+    
+    uint32_t flags = irq_save();
+    if (timer_oneshot) {
+        uint32_t ticks = timer_resume_periodic();
+        if (ticks) {
+            nohz_skipped += ticks;
+            timer_ticks += ticks;
+            softirq_raise(SOFTIRQ_TIMER);
+        }
+    }
+    irq_restore(flags);
+    
+    /* Not on an interrupt exit path, so run the bottom half here */
+    softirq_run();
+}
+
+/* Top half: count the tick and leave the rest to timer_softirq() */
+void timer_handler(void) {
+    timer_interrupts++;
+    
+    uint32_t ticks = 1;
+    if (timer_oneshot) {
+        ticks = timer_resume_periodic();
+        if (ticks == 0) {
+            /* Fired a hair before the TSC boundary, count the tick anyway */
+            tick_tsc += tsc_per_tick;
+            ticks = 1;
+        }
+        nohz_skipped += ticks - 1;
+    } else if (timer_nohz) {
+        tick_tsc = rdtsc();
+    }
+    
+    timer_ticks += ticks;
+    softirq_raise(SOFTIRQ_TIMER);
 }
 
 uint32_t timer_get_ticks(void) {
     return timer_ticks;
 }
 
+/* TSC cycles per tick, 0 if the TSC could not be calibrated */
+uint32_t timer_tsc_per_tick(void) {
+    return tsc_per_tick;
+}
+
 uint32_t timer_get_seconds(void) {
     return timer_ticks / TIMER_FREQUENCY;
 }
 
 void timer_sleep(uint32_t ms) {
+    /* Block on the timer wheel once there is a scheduler to run something else */
+    if (process_get_current()) {
+        process_sleep(ms);
+        return;
+    }
+    
     uint32_t target_ticks = timer_ticks + ms;
     while (timer_ticks < target_ticks) {
         __asm__ volatile ("hlt"); /* Wait for next interrupt */
     }
 }
 
+/* Busy-wait, for hardware that needs a settling time before interrupts work */
+void timer_udelay(uint32_t us) {
+    if (!tsc_per_tick) {
+        /* A write to the POST port takes about a microsecond */
+        while (us--) outb(0x80, 0);
+        return;
+    }
+    
+    uint64_t cycles = (uint64_t)us * (tsc_per_tick / 1000);
+    uint64_t start = rdtsc();
+    while (rdtsc() - start < cycles) {
+        cpu_relax();
+    }
+}
+
+/* TSC interval in microseconds, saturating; 0 without a calibrated TSC */
+uint32_t timer_tsc_to_us(uint64_t cycles) {
+    uint32_t per_us = tsc_per_tick / (1000000 / TIMER_FREQUENCY);
+    if (!per_us) return 0;
+    if (!(cycles >> 32)) return (uint32_t)cycles / per_us;
+    
+    /* Past 4G cycles, 64us steps are precise enough */
+    uint64_t coarse = cycles >> 16;
+    if (coarse >> 32) return 0xFFFFFFFF;
+    uint32_t us = (uint32_t)coarse / per_us;
+    return us > (0xFFFFFFFF >> 16) ? 0xFFFFFFFF : us << 16;
+}
+
+void timer_info(void) {
+    uint32_t seconds = timer_ticks / TIMER_FREQUENCY;
+    
+    vga_printf("Tick mode:   %s, %u interrupts (%u/s)\n",
+               timer_nohz ? "tickless idle" : "periodic", timer_interrupts,
+               seconds ? timer_interrupts / seconds : timer_interrupts);
+    vga_printf("Idle:        %u one-shot halts, %u ticks skipped, %u cut short\n",
+               nohz_entries, nohz_skipped, nohz_kicks);
+}
+
 void time_init(void) {
     /* Initialize with default time */
     vga_puts("System time initialized\n");
@@ -86,6 +340,7 @@ system_time_t time_get(void) {
 void time_set(system_time_t* time) {
     if (time) {
         system_time = *time;
+        vdso_update(timer_ticks);
     }
 }
 
@@ -0,0 +1,143 @@
+#include "timer.h"
+#include "kernel.h"
+#include "vga.h"
+#include "cpu.h"
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+
+static timer_event_t* timer_wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+static uint32_t wheel_now = 0;          /* Last tick the wheel has processed */
+static uint32_t wheel_pending = 0;
+static uint32_t wheel_cascades = 0;     /* Higher level slots redistributed */
+static uint32_t wheel_expired = 0;
+static uint32_t wheel_late_ticks = 0;   /* Sum of expiry lateness */
+static uint32_t wheel_late_max = 0;
+
+static void timer_wheel_insert(timer_event_t* event) {
+    uint32_t delta = event->expires - wheel_now;
+    if (delta > TIMER_WHEEL_MAX) {
+        delta = TIMER_WHEEL_MAX;
+        event->expires = wheel_now + delta;
+    }
+    
+    /* The level is the first one whose span covers the delay */
+    uint32_t level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 &&
+           delta >= (1u << (TIMER_WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    uint32_t index = (event->expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    
+    timer_event_t** slot = &timer_wheel[level][index];
+    event->slot = slot;
+    event->prev = NULL;
+    event->next = *slot;
+    if (*slot) (*slot)->prev = event;
+    *slot = event;
+}
+
+static void timer_wheel_unlink(timer_event_t* event) {
+    if (event->prev) event->prev->next = event->next;
+    else *event->slot = event->next;
+    if (event->next) event->next->prev = event->prev;
+    event->next = NULL;
+    event->prev = NULL;
+    event->slot = NULL;
+}
+
+void timer_event_add(timer_event_t* event, uint32_t expires) {
+    uint32_t flags = irq_save();
+    if (event->slot) {
+        timer_wheel_unlink(event);
+        wheel_pending--;
+    }
+    /* The current tick has been processed, anything already due runs on the next */
+    if ((int32_t)(expires - wheel_now) <= 0) expires = wheel_now + 1;
+    event->expires = expires;
+    timer_wheel_insert(event);
+    wheel_pending++;
+    timer_nohz_kick(event->expires);
+    irq_restore(flags);
+}
+
+void timer_event_cancel(timer_event_t* event) {
+    uint32_t flags = irq_save();
+    if (event->slot) {
+        timer_wheel_unlink(event);
+        wheel_pending--;
+    }
+    irq_restore(flags);
+}
+
+/* Move every event of one higher level slot down to where it now belongs.
+ * Returns the slot index so the caller knows whether to go up a level. */
+static uint32_t timer_wheel_cascade(uint32_t level) {
+    uint32_t index = (wheel_now >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    timer_event_t* event = timer_wheel[level][index];
+    timer_wheel[level][index] = NULL;
+    
+    while (event) {
+        timer_event_t* next = event->next;
+        timer_wheel_insert(event);
+        event = next;
+    }
+    
+    wheel_cascades++;
+    return index;
+}
+
+/* Called from the timer softirq with the current tick count. The lists are
+ * only touched with interrupts off; callbacks run with them enabled. */
+void timer_wheel_run(uint32_t now) {
+    uint32_t flags = irq_save();
+    while ((int32_t)(now - wheel_now) > 0) {
+        wheel_now++;
+        
+        uint32_t index = wheel_now & TIMER_WHEEL_MASK;
+        if (index == 0) {
+            for (uint32_t level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+                if (timer_wheel_cascade(level) != 0) break;
+            }
+        }
+        
+        /* Every event left in this slot expires on this very tick */
+        timer_event_t* event;
+        while ((event = timer_wheel[0][index]) != NULL) {
+            timer_wheel_unlink(event);
+            wheel_pending--;
+            wheel_expired++;
+            
+            uint32_t late = now - event->expires;
+            wheel_late_ticks += late;
+            if (late > wheel_late_max) wheel_late_max = late;
+            
+            irq_restore(flags);
+            event->callback(event->data);
+            flags = irq_save();
+        }
+    }
+    irq_restore(flags);
+}
+
+/* Ticks until the next event may expire, at most limit. Level 0 gives the
+ * exact deadline; later events are only bounded by the next cascade. */
+uint32_t timer_wheel_next(uint32_t limit) {
+    if (wheel_pending == 0) return limit;
+    
+    uint32_t ticks = TIMER_WHEEL_SLOTS - (wheel_now & TIMER_WHEEL_MASK);
+    for (uint32_t i = 1; i < ticks && i < limit; i++) {
+        if (timer_wheel[0][(wheel_now + i) & TIMER_WHEEL_MASK]) return i;
+    }
+    return ticks < limit ? ticks : limit;
+}
+
+void timer_wheel_info(void) {
+    uint32_t seconds = wheel_now / TIMER_FREQUENCY;
+    
+    vga_printf("Timer wheel: %u levels x %u slots, %u pending\n",
+               TIMER_WHEEL_LEVELS, TIMER_WHEEL_SLOTS, wheel_pending);
+    vga_printf("Expired:     %u (lateness avg %u, max %u ticks)\n", wheel_expired,
+               wheel_expired ? wheel_late_ticks / wheel_expired : 0, wheel_late_max);
+    vga_printf("Cascades:    %u (%u/s)\n", wheel_cascades,
+               seconds ? wheel_cascades / seconds : wheel_cascades);
+}
\ No newline at end of file
@@ -0,0 +1,45 @@
+#include "tss.h"
+#include "kernel.h"
+#include "vga.h"
+#include "smp.h"
+
+extern uint8_t gdt_start[];
+
+static tss_t cpu_tss[MAX_CPUS];
+
+/* Fill in a GDT descriptor. granularity holds the flag nibble (0x40 for a
+ * 32-bit segment, 0x80 for a page granular limit). */
+void gdt_set_entry(uint32_t selector, uint32_t base, uint32_t limit,
+                   uint8_t access, uint8_t granularity) {
+    uint8_t* entry = gdt_start + (selector & ~7);
+    entry[0] = limit & 0xFF;
+    entry[1] = (limit >> 8) & 0xFF;
+    entry[2] = base & 0xFF;
+    entry[3] = (base >> 8) & 0xFF;
+    entry[4] = (base >> 16) & 0xFF;
+    entry[5] = access;
+    entry[6] = (granularity & 0xF0) | ((limit >> 16) & 0x0F);
+    entry[7] = (base >> 24) & 0xFF;
+}
+
+void tss_init(void) {
+    uint32_t cpu = this_cpu()->id;
+    tss_t* tss = &cpu_tss[cpu];
+    memset(tss, 0, sizeof(*tss));
+    tss->ss0 = KERNEL_DATA_SELECTOR;
+    tss->iomap_base = sizeof(*tss);    /* No I/O permission bitmap */
+    
+    /* Available 32-bit TSS, byte granular limit, present, DPL 0 */
+    gdt_set_entry(TSS_SELECTOR(cpu), (uint32_t)tss, sizeof(*tss) - 1, 0x89, 0x00);
+    
+    __asm__ volatile ("ltr %w0" : : "r"(TSS_SELECTOR(cpu)));
+    if (cpu == 0) vga_puts("Task state segment loaded\n");
+}
+
+void tss_set_kernel_stack(uint32_t esp0) {
+    cpu_tss[this_cpu()->id].esp0 = esp0;
+}
+
+tss_t* tss_current(void) {
+    return &cpu_tss[this_cpu()->id];
+}
\ No newline at end of file
@@ -0,0 +1,87 @@
+#include "vdso.h"
+#include "memory.h"
+#include "kernel.h"
+#include "vga.h"
+#include "cpu.h"
+
+static uint32_t vdso_frame = 0;         /* Clock page, never freed */
+static vdso_data_t* vdso = NULL;        /* Its direct map address */
+static uint32_t vdso_updates = 0;
+
+void vdso_init(void) {
+    vdso_frame = alloc_zeroed_page();
+    if (!vdso_frame) kernel_panic("No memory for the vDSO page");
+    vdso = PHYS_TO_VIRT(vdso_frame);
+    
+    vdso->tsc_per_us = timer_tsc_per_tick() / (1000000 / TIMER_FREQUENCY);
+    vdso->tsc_base = rdtsc();
+    vdso_update(timer_get_ticks());
+}
+
+/* Map frame read-only for user mode, replacing what fork copied there */
+static int vdso_map_page(page_directory_t* dir, uint32_t addr, uint32_t frame) {
+    page_table_entry_t* entry = get_page_entry(dir, addr, PAGE_PRESENT | PAGE_USER);
+    if (!entry) return 0;
+    
+    if (entry->present) page_unref(entry->address << 12);
+    map_page_in(dir, addr, frame, PAGE_PRESENT | PAGE_USER);
+    return 1;
+}
+
+/* Give an address space the shared clock page and a task page of its own */
+int vdso_map(page_directory_t* dir, uint32_t pid) {
+    uint32_t task = alloc_zeroed_page();
+    if (!task) return 0;
+    ((vdso_task_t*)PHYS_TO_VIRT(task))->pid = pid;
+    
+    uint32_t flags = irq_save();
+    int mapped = vdso_map_page(dir, VDSO_TASK_ADDR, task);
+    if (!mapped) {
+        free_page(task);
+    } else {
+        /* Every mapping holds a reference, the kernel keeps the first */
+        page_ref(vdso_frame);
+        mapped = vdso_map_page(dir, VDSO_DATA_ADDR, vdso_frame);
+        if (!mapped) page_unref(vdso_frame);
+    }
+    irq_restore(flags);
+    return mapped;
+}
+
+/* Publish the clock, from the timer bottom half and when the wall time is
+ * set. The TSC base only advances by whole microseconds, so a reader
+ * interpolating from the old base and one using the new agree. */
+void vdso_update(uint32_t ticks) {
+    if (!vdso) return;
+    
+    uint32_t flags = irq_save();
+    vdso->seq++;
+    __asm__ volatile ("" : : : "memory");
+    
+    vdso->ticks = ticks;
+    if (vdso->tsc_per_us) {
+        uint64_t delta = rdtsc() - vdso->tsc_base;
+        while (delta >> 32) {
+            uint32_t us = 0xFFFFFFFF / vdso->tsc_per_us;
+            delta -= (uint64_t)us * vdso->tsc_per_us;
+            vdso->tsc_base += (uint64_t)us * vdso->tsc_per_us;
+            vdso->us_base += us;
+        }
+        uint32_t us = (uint32_t)delta / vdso->tsc_per_us;
+        vdso->tsc_base += (uint64_t)us * vdso->tsc_per_us;
+        vdso->us_base += us;
+    } else {
+        vdso->us_base = (uint64_t)ticks * (1000000 / TIMER_FREQUENCY);
+    }
+    vdso->wall = time_get();
+    vdso_updates++;
+    
+    __asm__ volatile ("" : : : "memory");
+    vdso->seq++;
+    irq_restore(flags);
+}
+
+void vdso_info(void) {
+    vga_printf("vDSO:        clock page at 0x%x, task page at 0x%x, %u updates\n",
+               VDSO_DATA_ADDR, VDSO_TASK_ADDR, vdso_updates);
+}
\ No newline at end of file
@@ -0,0 +1,236 @@
+#include "memory.h"
+#include "kernel.h"
+#include "vga.h"
+#include "cpu.h"
+#include "softirq.h"
+#include "smp.h"
+
+/* One virtually contiguous allocation, followed by an unmapped guard page */
+typedef struct vm_area {
+    uint32_t addr;
+    uint32_t pages;
+    uint32_t* frames;       /* Backing frames, kept until the area is purged;
+                             * NULL for ioremap() areas */
+    int lazy;               /* Unmapped but not yet flushed from the TLB */
+    struct vm_area* next;   /* Address ordered list of every area */
+} vm_area_t;
+
+static vm_area_t* vm_areas = NULL;
+static uint32_t vmalloc_mapped = 0;     /* Pages in live areas */
+static uint32_t vmalloc_lazy = 0;       /* Pages waiting for a purge */
+static uint32_t vmalloc_purges = 0;
+
+static void vmalloc_purge_work(void* data);
+static work_t vmalloc_purge_worker = { vmalloc_purge_work, NULL, 0, NULL };
+
+/* First fit in the address ordered list, leaving a guard page after each
+ * area. The first page of the range stays unmapped too, so every area has a
+ * guard on both sides (kernel stacks overflow downwards). */
+static uint32_t vmalloc_find_space(uint32_t pages, vm_area_t*** link) {
+    uint32_t size = (pages + 1) * PAGE_SIZE;
+    uint32_t start = VMALLOC_START + PAGE_SIZE;
+    vm_area_t** prev = &vm_areas;
+    
+    while (*prev) {
+        if ((*prev)->addr - start >= size) break;
+        start = (*prev)->addr + ((*prev)->pages + 1) * PAGE_SIZE;
+        prev = &(*prev)->next;
+    }
+    
+    if (start > VMALLOC_END || VMALLOC_END - start < size) return 0;
+    *link = prev;
+    return start;
+}
+
+/* Flush the TLB once for every lazily unmapped area, on every CPU, then give
+ * their frames and address space back */
+void vmalloc_purge(void) {
+    uint32_t flags = irq_save();
+    if (vmalloc_lazy == 0) {
+        irq_restore(flags);
+        return;
+    }
+    
+    if (vmalloc_lazy > TLB_FLUSH_CEILING) {
+        tlb_flush_all();
+    } else {
+        for (vm_area_t* area = vm_areas; area; area = area->next) {
+            if (area->lazy) tlb_flush_range(area->addr, area->pages);
+        }
+    }
+    smp_tlb_shootdown();
+    
+    vm_area_t** link = &vm_areas;
+    while (*link) {
+        vm_area_t* area = *link;
+        if (!area->lazy) {
+            link = &area->next;
+            continue;
+        }
+        
+        *link = area->next;
+        if (area->frames) {
+            for (uint32_t i = 0; i < area->pages; i++) {
+                free_page(area->frames[i]);
+            }
+            kfree(area->frames);
+        }
+        kfree(area);
+    }
+    
+    vmalloc_lazy = 0;
+    vmalloc_purges++;
+    irq_restore(flags);
+}
+
+/* Lazily freed areas still hold address space, reclaim it before giving up.
+ * Interrupts must be off. */
+static uint32_t vmalloc_reserve(uint32_t pages, vm_area_t*** link) {
+    uint32_t addr = vmalloc_find_space(pages, link);
+    if (!addr && vmalloc_lazy) {
+        vmalloc_purge();
+        addr = vmalloc_find_space(pages, link);
+    }
+    return addr;
+}
+
+/* Purges past the lazy limit run in kworker rather than in whoever freed */
+static void vmalloc_purge_work(void* data) {
+    (void)data;
+    vmalloc_purge();
+}
+
+void* vmalloc(uint32_t size) {
+    uint32_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (pages == 0) return NULL;
+    
+    vm_area_t* area = kmalloc(sizeof(vm_area_t));
+    if (!area) return NULL;
+    area->frames = kmalloc(pages * sizeof(uint32_t));
+    if (!area->frames) {
+        kfree(area);
+        return NULL;
+    }
+    
+    /* The area list is shared with the purge worker */
+    uint32_t flags = irq_save();
+    
+    vm_area_t** link;
+    uint32_t addr = vmalloc_reserve(pages, &link);
+    if (!addr) {
+        irq_restore(flags);
+        kfree(area->frames);
+        kfree(area);
+        return NULL;
+    }
+    
+    for (uint32_t i = 0; i < pages; i++) {
+        area->frames[i] = alloc_page();
+        if (!area->frames[i]) {
+            /* Nothing was mapped yet, so the frames go straight back */
+            while (i-- > 0) free_page(area->frames[i]);
+            irq_restore(flags);
+            kfree(area->frames);
+            kfree(area);
+            return NULL;
+        }
+    }
+    
+    /* The range was unmapped and flushed, so mapping it needs no invalidation.
+     * Entries are not global, a CR3 reload is enough to drop them later. */
+    for (uint32_t i = 0; i < pages; i++) {
+        if (!map_page(addr + i * PAGE_SIZE, area->frames[i], PAGE_PRESENT | PAGE_WRITE)) {
+            unmap_range(addr, i);
+            for (i = 0; i < pages; i++) free_page(area->frames[i]);
+            irq_restore(flags);
+            kfree(area->frames);
+            kfree(area);
+            return NULL;
+        }
+    }
+    
+    area->addr = addr;
+    area->pages = pages;
+    area->lazy = 0;
+    area->next = *link;
+    *link = area;
+    vmalloc_mapped += pages;
+    irq_restore(flags);
+    
+    return (void*)addr;
+}
+
+void vfree(void* ptr) {
+    if (!ptr) return;
+    
+    uint32_t flags = irq_save();
+    vm_area_t* area = vm_areas;
+    while (area && (area->addr != (uint32_t)ptr || area->lazy)) {
+        area = area->next;
+    }
+    if (!area) {
+        irq_restore(flags);
+        return;
+    }
+    
+    /* Clear the entries now but leave the invalidation to the next purge;
+     * the frames cannot be reused until then */
+    for (uint32_t i = 0; i < area->pages; i++) {
+        page_table_entry_t* entry = get_page_entry(NULL, area->addr + i * PAGE_SIZE, 0);
+        if (entry) *(uint32_t*)entry = 0;
+    }
+    
+    area->lazy = 1;
+    vmalloc_mapped -= area->pages;
+    vmalloc_lazy += area->pages;
+    
+    if (vmalloc_lazy >= VMALLOC_LAZY_MAX_PAGES) {
+        work_queue(&vmalloc_purge_worker);
+    }
+    irq_restore(flags);
+}
+
+/* Map device registers into the vmalloc range, uncached. The area owns no
+ * frames, so a purge only gives the address space back. */
+void* ioremap(uint32_t phys, uint32_t size) {
+    uint32_t offset = phys & (PAGE_SIZE - 1);
+    uint32_t pages = (offset + size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (pages == 0) return NULL;
+    
+    vm_area_t* area = kmalloc(sizeof(vm_area_t));
+    if (!area) return NULL;
+    
+    uint32_t flags = irq_save();
+    vm_area_t** link;
+    uint32_t addr = vmalloc_reserve(pages, &link);
+    if (!addr) {
+        irq_restore(flags);
+        kfree(area);
+        return NULL;
+    }
+    
+    if (!map_range(addr, phys - offset, pages, PAGE_PRESENT | PAGE_WRITE | PAGE_NOCACHE | PAGE_WRITETHROUGH)) {
+        irq_restore(flags);
+        kfree(area);
+        return NULL;
+    }
+    area->addr = addr;
+    area->pages = pages;
+    area->frames = NULL;
+    area->lazy = 0;
+    area->next = *link;
+    *link = area;
+    vmalloc_mapped += pages;
+    irq_restore(flags);
+    
+    return (void*)(addr + offset);
+}
+
+void iounmap(void* ptr) {
+    vfree((void*)((uint32_t)ptr & ~(PAGE_SIZE - 1)));
+}
+
+void vmalloc_info(void) {
+    vga_printf("\nvmalloc: %d pages mapped, %d awaiting purge, %d purges\n",
+               vmalloc_mapped, vmalloc_lazy, vmalloc_purges);
+}
\ No newline at end of file
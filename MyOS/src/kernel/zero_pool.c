@@ -0,0 +1,79 @@
+#include "memory.h"
+#include "kernel.h"
+#include "vga.h"
+#include "cmdline.h"
+#include "cpu.h"
+
+/*
+ * Pool of frames that were cleared while the CPU had nothing better to do.
+ * The frames are chained through their mem_map descriptors so the page
+ * contents stay zero.
+ */
+static page_t* zero_pool = NULL;
+static uint32_t zero_pool_count = 0;
+static uint32_t zero_pool_watermark = ZERO_POOL_WATERMARK;
+static uint32_t zero_pool_hits = 0;     /* Served from the pool */
+static uint32_t zero_pool_inline = 0;   /* Zeroed by the caller */
+static uint32_t zero_pool_refills = 0;  /* Frames zeroed in the background */
+
+void zero_pool_init(void) {
+    /* zeropool=<frames> overrides the watermark, 0 disables the pool */
+    const char* value = cmdline_get("zeropool");
+    if (value && *value) {
+        uint32_t watermark = 0;
+        while (*value >= '0' && *value <= '9') {
+            watermark = watermark * 10 + (*value++ - '0');
+        }
+        zero_pool_watermark = watermark;
+    }
+}
+
+uint32_t alloc_zeroed_page(void) {
+    uint32_t flags = irq_save();
+    page_t* page = zero_pool;
+    if (page) {
+        zero_pool = page->next;
+        page->next = NULL;
+        page->flags &= ~PAGE_FLAG_ZEROED;
+        zero_pool_count--;
+        zero_pool_hits++;
+    }
+    irq_restore(flags);
+    
+    if (page) return page_to_phys(page);
+    
+    uint32_t phys = alloc_page();
+    if (!phys) return 0;
+    
+    memset(PHYS_TO_VIRT(phys), 0, PAGE_SIZE);
+    zero_pool_inline++;
+    return phys;
+}
+
+/* Zero one frame into the pool. Returns 0 once the pool is at its
+ * watermark, so the idle loop knows it can halt. */
+int zero_pool_refill(void) {
+    if (zero_pool_count >= zero_pool_watermark) return 0;
+    
+    uint32_t phys = alloc_page();
+    if (!phys) return 0;
+    
+    /* Clearing happens with interrupts enabled, only the push is atomic */
+    memset(PHYS_TO_VIRT(phys), 0, PAGE_SIZE);
+    
+    page_t* page = phys_to_page(phys);
+    uint32_t flags = irq_save();
+    page->flags |= PAGE_FLAG_ZEROED;
+    page->next = zero_pool;
+    zero_pool = page;
+    zero_pool_count++;
+    zero_pool_refills++;
+    irq_restore(flags);
+    return 1;
+}
+
+void zero_pool_info(void) {
+    vga_printf("\nZeroed pool: %d/%d frames, %d hits, %d inline, %d refills\n",
+               zero_pool_count, zero_pool_watermark,
+               zero_pool_hits, zero_pool_inline, zero_pool_refills);
+}
\ No newline at end of file